@@ -0,0 +1,357 @@
+// image_io.h - PNG and QOI writers for rendered frames, with no library dependencies
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// An 8-bit RGB image, top row first
+struct Image
+{
+    int width = 0, height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+inline uint32_t image_crc32(const uint8_t *data, size_t size, uint32_t crc = 0)
+{
+    // Built once; a local static is initialised safely even when several
+    // encoder threads get here first at the same time
+    static const std::array<uint32_t, 256> table = []
+    {
+        std::array<uint32_t, 256> entries;
+        for (uint32_t n = 0; n < 256; ++n)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            entries[n] = c;
+        }
+        return entries;
+    }();
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+inline uint32_t image_adler32(const uint8_t *data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        a = (a + data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    return (b << 16) | a;
+}
+
+// Deflate with greedy LZ77 matching and the fixed Huffman code, in one
+// block. Rendered frames are mostly flat colour, which this already
+// shrinks by an order of magnitude; dynamic codes would gain little more.
+struct DeflateWriter
+{
+    std::vector<uint8_t> &out;
+    uint32_t bitBuffer = 0;
+    int bitCount = 0;
+
+    explicit DeflateWriter(std::vector<uint8_t> &out) : out(out) {}
+
+    void bits(uint32_t value, int count)
+    {
+        bitBuffer |= value << bitCount;
+        bitCount += count;
+        while (bitCount >= 8)
+        {
+            out.push_back(uint8_t(bitBuffer));
+            bitBuffer >>= 8;
+            bitCount -= 8;
+        }
+    }
+
+    // Huffman codes are sent most significant bit first
+    void code(uint32_t value, int count)
+    {
+        uint32_t reversed = 0;
+        for (int i = 0; i < count; ++i)
+            reversed |= ((value >> i) & 1) << (count - 1 - i);
+        bits(reversed, count);
+    }
+
+    void literal(uint32_t symbol)
+    {
+        if (symbol < 144)
+            code(0x30 + symbol, 8);
+        else if (symbol < 256)
+            code(0x190 + symbol - 144, 9);
+        else if (symbol < 280)
+            code(symbol - 256, 7);
+        else
+            code(0xC0 + symbol - 280, 8);
+    }
+
+    void match(uint32_t length, uint32_t distance)
+    {
+        static const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                                35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+        static const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                                3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+        static const uint16_t distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                                  193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                                  6145, 8193, 12289, 16385, 24577};
+        static const uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+                                                  6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+        int l = 28;
+        while (lengthBase[l] > length)
+            --l;
+        literal(257 + l);
+        bits(length - lengthBase[l], lengthExtra[l]);
+        int d = 29;
+        while (distanceBase[d] > distance)
+            --d;
+        code(d, 5);
+        bits(distance - distanceBase[d], distanceExtra[d]);
+    }
+
+    void compress(const uint8_t *data, size_t size)
+    {
+        const uint32_t WINDOW = 32768, MAX_MATCH = 258, MAX_CHAIN = 32;
+        const uint32_t NONE = 0xFFFFFFFFu;
+        std::vector<uint32_t> head(1 << 15, NONE), previous(WINDOW, NONE);
+        auto hash = [&](size_t i)
+        { return ((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & 0x7FFF; };
+        auto insert = [&](size_t i)
+        {
+            if (i + 2 >= size)
+                return;
+            uint32_t h = hash(i);
+            previous[i % WINDOW] = head[h];
+            head[h] = uint32_t(i);
+        };
+
+        bits(1, 1); // Final block
+        bits(1, 2); // Fixed Huffman codes
+        size_t i = 0;
+        while (i < size)
+        {
+            uint32_t bestLength = 0, bestDistance = 0;
+            if (i + 2 < size)
+            {
+                uint32_t limit = uint32_t(std::min<size_t>(MAX_MATCH, size - i));
+                uint32_t candidate = head[hash(i)];
+                for (uint32_t chain = 0; chain < MAX_CHAIN && candidate != NONE && i - candidate <= WINDOW - 1; ++chain)
+                {
+                    uint32_t length = 0;
+                    while (length < limit && data[candidate + length] == data[i + length])
+                        ++length;
+                    if (length > bestLength)
+                    {
+                        bestLength = length;
+                        bestDistance = uint32_t(i - candidate);
+                        if (length == limit)
+                            break;
+                    }
+                    uint32_t next = previous[candidate % WINDOW];
+                    if (next == NONE || next >= candidate)
+                        break;
+                    candidate = next;
+                }
+            }
+            if (bestLength >= 3)
+            {
+                match(bestLength, bestDistance);
+                for (uint32_t k = 0; k < bestLength; ++k)
+                    insert(i + k);
+                i += bestLength;
+            }
+            else
+            {
+                literal(data[i]);
+                insert(i);
+                ++i;
+            }
+        }
+        literal(256);
+        if (bitCount > 0)
+            bits(0, 8 - bitCount);
+    }
+};
+
+inline void image_put32(std::vector<uint8_t> &out, uint32_t value)
+{
+    out.push_back(uint8_t(value >> 24));
+    out.push_back(uint8_t(value >> 16));
+    out.push_back(uint8_t(value >> 8));
+    out.push_back(uint8_t(value));
+}
+
+inline uint8_t png_paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return uint8_t(a);
+    return uint8_t(pb <= pc ? b : c);
+}
+
+// Value the PNG filter type predicts from the left, upper and upper-left bytes
+inline int png_predict(int filter, int a, int b, int c)
+{
+    switch (filter)
+    {
+    case 1:
+        return a;
+    case 2:
+        return b;
+    case 3:
+        return (a + b) / 2;
+    case 4:
+        return png_paeth(a, b, c);
+    default:
+        return 0;
+    }
+}
+
+// Encodes an RGB image as PNG. Each row takes whichever filter leaves the
+// smallest residuals, the usual heuristic from the PNG specification.
+inline std::vector<uint8_t> encode_png(const Image &image)
+{
+    size_t stride = size_t(image.width) * 3;
+    std::vector<uint8_t> filtered;
+    filtered.reserve((stride + 1) * image.height);
+    std::vector<uint8_t> zeroRow(stride, 0);
+    for (int y = 0; y < image.height; ++y)
+    {
+        const uint8_t *row = &image.pixels[y * stride];
+        const uint8_t *up = y > 0 ? row - stride : zeroRow.data();
+        uint8_t bestFilter = 0;
+        uint64_t bestCost = ~0ull;
+        for (uint8_t filter = 0; filter < 5; ++filter)
+        {
+            uint64_t cost = 0;
+            for (size_t x = 0; x < stride; ++x)
+            {
+                int a = x >= 3 ? row[x - 3] : 0, b = up[x], c = x >= 3 ? up[x - 3] : 0;
+                uint8_t residual = uint8_t(row[x] - png_predict(filter, a, b, c));
+                cost += residual < 128 ? residual : 256 - residual;
+            }
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestFilter = filter;
+            }
+        }
+        filtered.push_back(bestFilter);
+        for (size_t x = 0; x < stride; ++x)
+        {
+            int a = x >= 3 ? row[x - 3] : 0, b = up[x], c = x >= 3 ? up[x - 3] : 0;
+            filtered.push_back(uint8_t(row[x] - png_predict(bestFilter, a, b, c)));
+        }
+    }
+
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    DeflateWriter(zlib).compress(filtered.data(), filtered.size());
+    image_put32(zlib, image_adler32(filtered.data(), filtered.size()));
+
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    auto chunk = [&](const char *type, const std::vector<uint8_t> &data)
+    {
+        image_put32(png, uint32_t(data.size()));
+        size_t start = png.size();
+        png.insert(png.end(), type, type + 4);
+        png.insert(png.end(), data.begin(), data.end());
+        image_put32(png, image_crc32(&png[start], png.size() - start));
+    };
+    std::vector<uint8_t> header;
+    image_put32(header, image.width);
+    image_put32(header, image.height);
+    header.insert(header.end(), {8, 2, 0, 0, 0}); // 8-bit RGB, no interlace
+    chunk("IHDR", header);
+    chunk("IDAT", zlib);
+    chunk("IEND", {});
+    return png;
+}
+
+// Encodes an RGB image as QOI: lossless like PNG, but several times
+// faster to write, for captures where encoding time matters more than size
+inline std::vector<uint8_t> encode_qoi(const Image &image)
+{
+    std::vector<uint8_t> qoi = {'q', 'o', 'i', 'f'};
+    image_put32(qoi, image.width);
+    image_put32(qoi, image.height);
+    qoi.push_back(3); // RGB
+    qoi.push_back(0); // sRGB
+
+    // Kept as RGBA like the decoder's: a zeroed slot (alpha 0) must not match black
+    uint32_t index[64] = {};
+    uint8_t previous[3] = {0, 0, 0};
+    int run = 0;
+    size_t count = size_t(image.width) * image.height;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint8_t *px = &image.pixels[i * 3];
+        if (px[0] == previous[0] && px[1] == previous[1] && px[2] == previous[2])
+        {
+            ++run;
+            if (run == 62 || i + 1 == count)
+            {
+                qoi.push_back(uint8_t(0xC0 | (run - 1)));
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0)
+        {
+            qoi.push_back(uint8_t(0xC0 | (run - 1)));
+            run = 0;
+        }
+
+        int slot = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64;
+        uint32_t rgba = uint32_t(px[0]) << 24 | uint32_t(px[1]) << 16 | uint32_t(px[2]) << 8 | 0xFF;
+        if (index[slot] == rgba)
+            qoi.push_back(uint8_t(slot));
+        else
+        {
+            index[slot] = rgba;
+            int8_t dr = int8_t(px[0] - previous[0]);
+            int8_t dg = int8_t(px[1] - previous[1]);
+            int8_t db = int8_t(px[2] - previous[2]);
+            int8_t drg = int8_t(dr - dg), dbg = int8_t(db - dg);
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                qoi.push_back(uint8_t(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+            else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+            {
+                qoi.push_back(uint8_t(0x80 | (dg + 32)));
+                qoi.push_back(uint8_t((drg + 8) << 4 | (dbg + 8)));
+            }
+            else
+                qoi.insert(qoi.end(), {0xFE, px[0], px[1], px[2]});
+        }
+        std::memcpy(previous, px, 3);
+    }
+    qoi.insert(qoi.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+    return qoi;
+}
+
+// Writes a .qoi file when the path asks for one, otherwise PNG
+inline bool write_image(const std::string &path, const Image &image)
+{
+    bool qoi = path.size() >= 4 && path.compare(path.size() - 4, 4, ".qoi") == 0;
+    std::vector<uint8_t> bytes = qoi ? encode_qoi(image) : encode_png(image);
+    FILE *file = std::fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        std::cout << "ERROR::IMAGE::CANNOT_OPEN " << path << std::endl;
+        return false;
+    }
+    bool written = std::fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    written = std::fclose(file) == 0 && written;
+    if (!written)
+        std::cout << "ERROR::IMAGE::WRITE_FAILED " << path << std::endl;
+    return written;
+}
@@ -0,0 +1,100 @@
+// image_writer.h - Background threads that encode and write image files
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "image_io.h"
+
+// Encodes queued images on its own threads, so the renderer can get on
+// with the next frame. Each image is written independently, so files come
+// out the same whatever order the threads finish in. The queue holds two
+// images per thread; past that, write() waits for room instead of
+// buffering frames without bound.
+struct ImageWriter
+{
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, room;
+    std::deque<std::pair<std::string, Image>> queue;
+    size_t capacity = 0;
+    size_t failures = 0;
+    bool stopping = false;
+
+    // Starts count encoder threads; 0 means a quarter of the hardware threads
+    void start(unsigned count = 0)
+    {
+        if (!workers.empty())
+            return;
+        if (count == 0)
+            count = std::max(1u, std::thread::hardware_concurrency() / 4);
+        capacity = 2 * count;
+        failures = 0;
+        for (unsigned i = 0; i < count; ++i)
+            workers.emplace_back(&ImageWriter::workerLoop, this);
+    }
+
+    // Queues image for path, taking its pixels
+    void write(const std::string &path, Image &image)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            room.wait(lock, [this]
+                      {
+                          return queue.size() < capacity;
+                      });
+            queue.emplace_back(path, std::move(image));
+        }
+        image = Image();
+        wake.notify_one();
+    }
+
+    // Writes out everything queued and stops the threads; returns how many
+    // images could not be written
+    size_t finish()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+        workers.clear();
+        stopping = false;
+        return failures;
+    }
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::pair<std::string, Image> item;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]
+                          {
+                              return stopping || !queue.empty();
+                          });
+                if (queue.empty())
+                    return;
+                item = std::move(queue.front());
+                queue.pop_front();
+            }
+            room.notify_one();
+            bool written = write_image(item.first, item.second);
+            if (!written)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++failures;
+            }
+        }
+    }
+};
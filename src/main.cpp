@@ -4,11 +4,30 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include "image_io.h"
+#include "image_writer.h"
+#include "ray_tracer.h"
+#include "soft_raster.h"
 
 #include <iostream>
+#include <fstream>
+#include <limits>
+#include <string>
 #include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <chrono>
 #include <complex>
+#include <condition_variable>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <type_traits>
 #include <iostream>
 #include <unistd.h>
 
@@ -22,6 +41,7 @@ float centerX = 0.0f, centerY = 0.0f, centerZ = 0.0f;
 float centerSpeed = 0.01f;
 
 float vertexSpeed = 0.01f;
+glm::vec3 netOffset(0.0f); // VERTICES mode translation of the whole net, applied as the model matrix
 
 enum Change
 {
@@ -35,10 +55,18 @@ Change whatIsMoving = CAM;
 const char *vertexShaderSource = R"(
 #version 330 core
 layout (location = 0) in vec3 aPos;
-uniform mat4 projection;
-uniform mat4 view;
+layout (location = 1) in uint aPoly;
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+};
+uniform mat4 model;
+uniform samplerBuffer palette; // World transform of every polygon, one column per texel
 void main() {
-    gl_Position = projection * view * vec4(aPos, 1.0);
+    int base = 4 * int(aPoly);
+    mat4 world = mat4(texelFetch(palette, base), texelFetch(palette, base + 1),
+                      texelFetch(palette, base + 2), texelFetch(palette, base + 3));
+    gl_Position = projection * view * model * world * vec4(aPos, 1.0);
 })";
 
 // Fragment shader with constant color
@@ -53,10 +81,55 @@ void main() {
 const char *edgeVertexShaderSource = R"(
 #version 330 core
 layout (location = 0) in vec3 aPos;
-uniform mat4 projection;
-uniform mat4 view;
+layout (location = 1) in uint aPoly;
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+};
+uniform mat4 model;
+uniform samplerBuffer palette; // World transform of every polygon, one column per texel
+void main() {
+    int base = 4 * int(aPoly);
+    mat4 world = mat4(texelFetch(palette, base), texelFetch(palette, base + 1),
+                      texelFetch(palette, base + 2), texelFetch(palette, base + 3));
+    gl_Position = projection * view * model * world * vec4(aPos, 1.0);
+})";
+
+// Single-pass wireframe: faces carry barycentric coordinates and draw their
+// own outline. Fan diagonals are flagged so only polygon edges show.
+const char *wireVertexShaderSource = R"(
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in uint aPoly;
+layout (location = 2) in uint aCorner; // Corner 0-2, then a bit per diagonal opposite corner k
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+};
+uniform mat4 model;
+uniform samplerBuffer palette;
+out vec3 vBary;
+flat out vec3 vDiagonal;
 void main() {
-    gl_Position = projection * view * vec4(aPos, 1.0);
+    int base = 4 * int(aPoly);
+    mat4 world = mat4(texelFetch(palette, base), texelFetch(palette, base + 1),
+                      texelFetch(palette, base + 2), texelFetch(palette, base + 3));
+    uint corner = aCorner & 3u;
+    vBary = vec3(corner == 0u, corner == 1u, corner == 2u);
+    vDiagonal = vec3((uvec3(aCorner) >> uvec3(2u, 3u, 4u)) & 1u);
+    gl_Position = projection * view * model * world * vec4(aPos, 1.0);
+})";
+
+const char *wireFragmentShaderSource = R"(
+#version 330 core
+in vec3 vBary;
+flat in vec3 vDiagonal;
+out vec4 FragColor;
+void main() {
+    // Distance to each edge in pixels; diagonals are pushed a triangle away
+    vec3 d = (vBary + vDiagonal) / fwidth(vBary);
+    float edge = 1.0 - clamp(min(d.x, min(d.y, d.z)) - 0.5, 0.0, 1.0);
+    FragColor = mix(vec4(0.8, 0.8, 0.8, 0.3), vec4(0.0, 0.0, 0.0, 1.0), edge);
 })";
 
 // Edge fragment shader (solid color)
@@ -68,646 +141,3137 @@ void main() {
 })";
 
 typedef std::complex<float> cfloat;
-void build_buffer();
+typedef uint32_t PolyId; // Index of a polygon in the current net's arena
+const PolyId NO_PARENT = 0xFFFFFFFFu;
 struct Poly;
+Poly &getPoly(PolyId id);
+PolyId getPolyId(const Poly &poly);
+void build_buffer_layout();
+
+std::vector<PolyId> polygons;
+std::vector<PolyId> foldChildren; // Children of every polygon, one CSR range per parent
+PolyId dirtyBegin = 0, dirtyEnd = 0; // Id range holding every polygon with a dirty world transform
+bool buffersDirty = false; // Net geometry changed; the render loop rebuilds buffers once per frame
+std::vector<PolyId> changedPolys; // Polygons whose palette entries must be uploaded this frame
+bool fullUploadPending = false;   // Palette was resized or edited wholesale; upload it entirely
+unsigned int VAO, VBO, edgeEBO;
+bool animateFolds = false;           // Hinges move over foldDuration instead of snapping
+float foldDuration = 1.0f;           // Seconds for one hinge to fold completely
+std::vector<PolyId> animatingHinges; // Hinges still moving towards their target
+bool wireframeMode = false;          // Faces draw their own outlines; no separate edge pass
+bool proceduralGrid = true;          // Shader grid instead of the createGrid lines
+bool orderIndependent = true;        // Blend translucent faces with weighted blended OIT
+bool renderOnDemand = true;          // Sleep in glfwWaitEvents while nothing changes
+bool sceneDirty = true;              // Something happened that the last frame does not show
+bool softwareRender = false;         // Draw frames with the CPU rasterizer instead of the GPU
+bool rayTrace = false;               // Ray trace frames on the CPU, refining while the view holds still
+bool rayRefining = false;            // The ray-traced frame on screen can still take more samples
+bool captureFrames = false;          // Record every frame to an image sequence
+
+// Every polygon vertex of the current net, stored as one coordinate array per
+// axis. Each Poly owns the range [firstVertex, firstVertex + vertexCount).
+// These are the flat-net positions; folding never modifies them.
+struct VertexStore
+{
+    std::vector<float> x, y, z;
+
+    uint32_t add(const glm::vec3 &v)
+    {
+        x.push_back(v.x);
+        y.push_back(v.y);
+        z.push_back(v.z);
+        return static_cast<uint32_t>(x.size() - 1);
+    }
+
+    glm::vec3 get(uint32_t i) const
+    {
+        return glm::vec3(x[i], y[i], z[i]);
+    }
+
+    uint32_t size() const
+    {
+        return static_cast<uint32_t>(x.size());
+    }
+
+    void reset()
+    {
+        x.clear();
+        y.clear();
+        z.clear();
+    }
+};
 
-std::vector<Poly *> polygons;
-std::vector<float> buffer;
-std::vector<Poly *> foldingWait;
-unsigned int VAO, VBO;
-float angle = acos(sqrt(5) / 3);
+VertexStore vertexStore;
 
-// Represents a regular polygon in 3D space (flat on XY plane)
+// Represents a polygon of the flat net (on the XY plane) and its place in the
+// folded 3D structure
 struct Poly
 {
-    cfloat center;                   // Complex center of the polygon
-    std::vector<glm::vec3> vertices; // 3D vertices
-    std::vector<glm::vec3> faceVertices;
-    bool folded = false;                         // Indicates if the polygon has been folded in the 3D structure
-    std::vector<std::vector<Poly *>> dependents; // For each edge, a list of child polygons dependent on it
-    int dependentsCount = 0;
-
-    Poly(cfloat c, int sides, float radius, float angleOffset)
+    cfloat center;            // Complex center of the polygon
+    uint32_t firstVertex = 0; // First of this polygon's vertices in vertexStore
+    uint32_t vertexCount = 0; // Number of vertices (and edges)
+    PolyId parent = NO_PARENT;           // Polygon this one is hinged to
+    uint32_t hingeEdge = 0;              // Edge of the parent acting as the hinge
+    float hingeAngle = 0.0f;             // Current fold angle about the hinge
+    float foldAngle = 0.0f;              // Fold angle of the hinge in the finished solid (pi - dihedral)
+    float foldProgress = 0.0f;           // The hinge sits at foldAngle * foldProgress
+    float foldTarget = 0.0f;             // Progress the hinge is moving towards
+    bool animating = false;              // Listed in animatingHinges
+    glm::mat4 local = glm::mat4(1.0f);   // Hinge rotation, in the parent's flat-net frame
+    glm::mat4 world = glm::mat4(1.0f);   // Cached parent.world * local
+    bool worldDirty = false;             // world must be recomputed
+    bool folded = false;                 // Indicates if the polygon has been folded in the 3D structure
+    uint32_t firstChild = 0;             // Dependent polygons are foldChildren[firstChild, firstChild + childCount)
+    uint32_t childCount = 0;
+    PolyId subtreeEnd = 0;               // This polygon's subtree is the id range [own id, subtreeEnd)
+
+    // Builds a polygon from its flat-net corners, listed counterclockwise
+    Poly(const std::vector<cfloat> &corners)
     {
-        center = c;
-        for (int i = 0; i <= sides; ++i)
+        center = cfloat(0.0f, 0.0f);
+        firstVertex = vertexStore.size();
+        vertexCount = static_cast<uint32_t>(corners.size());
+        for (cfloat point : corners)
         {
-            float theta = 2.0f * M_PI * i / sides + angleOffset;
-            cfloat point = c + std::polar(radius, theta);
-            vertices.emplace_back(point.real(), point.imag(), 0.0f);
+            vertexStore.add(glm::vec3(point.real(), point.imag(), 0.0f));
+            center += point;
         }
-        glm::vec3 center3D(center.real(), center.imag(), 0.0f);
-        for (size_t i = 0; i < vertices.size() - 1; ++i)
-        {
-            faceVertices.push_back(center3D);
-            faceVertices.push_back(vertices[i]);
-            faceVertices.push_back(vertices[i + 1]);
-        }
-        dependents.resize(vertices.size() - 1);
+        center /= float(vertexCount);
+    }
+
+    // Vertex i of the polygon; i == vertexCount wraps around to vertex 0
+    glm::vec3 vertex(uint32_t i) const
+    {
+        return vertexStore.get(firstVertex + i % vertexCount);
     }
 
-    Poly(Poly &parent, const std::pair<int, int> &edgeAndSides)
+    // Vertex i in its folded position
+    glm::vec3 worldVertex(uint32_t i) const
     {
-        int edgeIndex = edgeAndSides.first;
-        int sides = edgeAndSides.second;
+        return glm::vec3(world * glm::vec4(vertex(i), 1.0f));
+    }
 
-        auto z1 = cfloat(parent.vertices[edgeIndex].x, parent.vertices[edgeIndex].y);
-        auto z2 = cfloat(parent.vertices[edgeIndex - 1].x, parent.vertices[edgeIndex - 1].y);
-        auto midpoint = (z1 + z2) / 2.0f;
+    // Rotation about the flat-net hinge edge by angleRad, in the parent's frame
+    glm::mat4 hingeTransform(float angleRad) const
+    {
+        const Poly &p = getPoly(parent);
+        glm::vec3 v1 = p.vertex(hingeEdge);
+        glm::vec3 v2 = p.vertex(hingeEdge + 1);
+        glm::vec3 pivot = 0.5f * (v1 + v2);
+
+        return glm::translate(glm::mat4(1.0f), pivot) *
+               glm::rotate(glm::mat4(1.0f), angleRad, glm::normalize(v2 - v1)) *
+               glm::translate(glm::mat4(1.0f), -pivot);
+    }
 
-        float theta = (sides - 2) * M_PI / (2.0 * sides);
-        auto parentCenter = parent.center;
-        cfloat toMid = midpoint - parentCenter;
-        center = midpoint + std::tan(theta) * std::abs(z1 - z2) * 0.5f * toMid / std::abs(toMid);
+    // Sets the angle of the hinge joining this polygon to its parent. The
+    // rotation is rebuilt from the flat-net hinge edge, so repeated folds
+    // never accumulate error, and vertex data is left untouched.
+    void foldThisOnly(float angleRad)
+    {
+        hingeAngle = angleRad;
+        local = hingeTransform(angleRad);
+        markSubtreeDirty();
+        buffersDirty = true;
+    }
 
-        float radius = std::abs(center - z1);
-        float initialAngle = std::atan2((z1 - center).imag(), (z1 - center).real());
+    // Places the hinge at fraction t of its fold, in closed form
+    void setFoldProgress(float t)
+    {
+        foldProgress = t;
+        foldThisOnly(foldAngle * t);
+    }
 
-        for (int i = 0; i <= sides; ++i)
+    // Sends the hinge to progress target, at once or animated over time
+    void foldTowards(float target)
+    {
+        foldTarget = target;
+        if (!animateFolds)
         {
-            float angle = 2.0f * M_PI * i / sides + initialAngle;
-            cfloat point = center + radius * std::polar(1.0f, angle);
-            vertices.emplace_back(point.real(), point.imag(), 0.0f);
+            setFoldProgress(target);
+            return;
         }
-        for (size_t i = 1; i < vertices.size() - 1; ++i)
+        if (!animating && foldProgress != target)
         {
-            faceVertices.push_back(vertices[0]);
-            faceVertices.push_back(vertices[i]);
-            faceVertices.push_back(vertices[i + 1]);
+            animating = true;
+            animatingHinges.push_back(getPolyId(*this));
         }
-
-        dependents.resize(vertices.size() - 1);
-        parent.dependents[edgeIndex - 1].push_back(this);
-        parent.dependentsCount++;
     }
 
-    // Rotate only this polygon around an axis passing through pivot point
-    void foldThisOnly(float angleRad, const glm::vec3 &axis, const glm::vec3 &pivot)
+    // Flags this polygon and everything hanging from it for a world update.
+    // The subtree is a contiguous id range, so this is a linear sweep.
+    void markSubtreeDirty()
     {
-
-        glm::mat4 rot = glm::rotate(glm::mat4(1.0f), angleRad, axis);
-
-        for (auto &v : vertices)
+        PolyId begin = getPolyId(*this);
+        for (PolyId id = begin; id < subtreeEnd; ++id)
+            getPoly(id).worldDirty = true;
+        if (dirtyBegin == dirtyEnd)
         {
-            glm::vec4 relative = glm::vec4(v - pivot, 1.0f);
-            glm::vec4 rotated = rot * relative;
-            v = glm::vec3(rotated) + pivot;
+            dirtyBegin = begin;
+            dirtyEnd = subtreeEnd;
         }
-        faceVertices.clear();
-        for (size_t i = 1; i < vertices.size() - 1; ++i)
+        else
         {
-            faceVertices.push_back(vertices[0]);
-            faceVertices.push_back(vertices[i]);
-            faceVertices.push_back(vertices[i + 1]);
+            dirtyBegin = std::min(dirtyBegin, begin);
+            dirtyEnd = std::max(dirtyEnd, subtreeEnd);
         }
-
-        build_buffer();
     }
 
-    void foldThisAndAll(float angleRad, const glm::vec3 &axis, const glm::vec3 &pivot)
+    PolyId child(uint32_t i) const
     {
-        foldThisOnly(angleRad, axis, pivot);
-
-        for (int edge = 0; edge < dependents.size(); ++edge)
-        {
-            for (Poly *child : dependents[edge])
-            {
-                if (child->folded)
-                    continue;
-                child->foldThisAndAll(angleRad, axis, pivot);
-            }
-        }
+        return foldChildren[firstChild + i];
     }
 
-    // Recursively fold all dependent polygons
-    void foldDependents(float angleRad)
+    // Fold every dependent polygon about its hinge, each to its own angle
+    void foldDependents()
     {
         folded = true;
-        std ::cout << "Folding" << center << std::endl;
-        for (int edge = 0; edge < dependents.size(); ++edge)
+        for (uint32_t i = 0; i < childCount; ++i)
         {
-            std ::cout << edge << std::endl;
-            const glm::vec3 &v1 = vertices[edge];
-            const glm::vec3 &v2 = vertices[edge + 1];
-            glm::vec3 edgeVec = glm::normalize(v2 - v1);
-            glm::vec3 pivot = 0.5f * (v1 + v2);
-
-            for (Poly *child : dependents[edge])
-            {
-                if (child->folded)
-                    continue;
-                child->foldThisAndAll(angleRad, edgeVec, pivot);
-                // child->foldDependents(angleRad);
-                foldingWait.push_back(child);
-            }
+            Poly &dependent = getPoly(child(i));
+            if (dependent.folded)
+                continue;
+            dependent.foldTowards(1.0f);
         }
     }
+
+    // Lays the dependents back flat
+    void unfoldDependents()
+    {
+        folded = false;
+        for (uint32_t i = 0; i < childCount; ++i)
+            getPoly(child(i)).foldTowards(0.0f);
+    }
 };
 
-// Builds a flat net approximating an icosahedron
-void build_icosahedron_net()
+// Owns every Poly of the current net. Polygons refer to each other by index
+// and own no heap memory, so reset() drops the whole net in O(1) and the
+// pool's capacity is reused by the next net.
+static_assert(std::is_trivially_destructible<Poly>::value, "PolyArena::reset relies on Poly owning nothing");
+struct PolyArena
 {
-    angle = acos(sqrt(5) / 3);
-    polygons.clear();
-    foldingWait.clear();
-    // Starting triangle
-    polygons.emplace_back(new Poly(cfloat(0.0f, 0.0f), 3, 2.0f, M_PI / 2.0f));
+    std::vector<Poly> pool;
 
-    // Create net with alternating 3-2 triangle attachments
-    for (int edge : {3, 2, 3, 2, 3, 2, 3, 2, 3})
+    PolyId create(const std::vector<cfloat> &corners)
     {
-        polygons.emplace_back(new Poly(*polygons.back(), std::pair<int, int>{edge, 3}));
+        pool.emplace_back(corners);
+        return static_cast<PolyId>(pool.size() - 1);
     }
 
-    // Mirror connections
-    for (int i = 0; i < 10; ++i)
+    // Adds a polygon hinged to edge `edge` of parent. The child lists are only
+    // built by build_fold_tree() once the net is complete.
+    PolyId attach(PolyId parent, uint32_t edge, const std::vector<cfloat> &corners)
     {
-        int edge = (i % 2 == 0) ? 2 : 3;
-        polygons.emplace_back(new Poly(*polygons[i], std::pair<int, int>{edge, 3}));
+        Poly child(corners);
+        child.parent = parent;
+        child.hingeEdge = edge;
+        pool.push_back(child);
+        return static_cast<PolyId>(pool.size() - 1);
     }
-    foldingWait.push_back(polygons[0]);
-    // Extract line segments for rendering
-    build_buffer();
-}
 
-void build_dodecahedron_net()
-{
+    void reset()
+    {
+        pool.clear();
+    }
+};
 
-    angle = acos(1 / sqrt(5));
+PolyArena polyArena;
 
-    polygons.clear();
-    foldingWait.clear();
+Poly &getPoly(PolyId id)
+{
+    return polyArena.pool[id];
+}
 
-    polygons.emplace_back(new Poly(cfloat(0.0f, 0.0f), 5, 2.0f, M_PI / 2.0f));
+PolyId getPolyId(const Poly &poly)
+{
+    return static_cast<PolyId>(&poly - polyArena.pool.data());
+}
 
-    for (int edge : {1, 5, 2, 5, 2, 5, 2, 5, 2})
-        polygons.emplace_back(new Poly(*polygons.back(), std::pair<int, int>{edge, 5}));
+// Flattens the tree built by attach() once a net is complete. Polygons, and
+// their vertices, are renumbered in depth-first order so that every subtree is
+// the contiguous id range [id, subtreeEnd) with parents before children; each
+// polygon's children become a CSR range of foldChildren in hinge edge order.
+// Everything here is linear in the size of the net.
+void build_fold_tree()
+{
+    std::vector<Poly> &pool = polyArena.pool;
+    uint32_t n = static_cast<uint32_t>(pool.size());
+
+    // Group children by parent and hinge edge with a counting sort keyed by
+    // the parent's vertex slot for that edge
+    std::vector<uint32_t> slot(vertexStore.size() + 1, 0);
+    for (const Poly &poly : pool)
+        if (poly.parent != NO_PARENT)
+            slot[pool[poly.parent].firstVertex + poly.hingeEdge + 1]++;
+    for (uint32_t i = 1; i < slot.size(); ++i)
+        slot[i] += slot[i - 1];
+    std::vector<PolyId> byParent(n);
+    std::vector<uint32_t> fill(slot.begin(), slot.end() - 1);
+    for (PolyId id = 0; id < n; ++id)
+        if (pool[id].parent != NO_PARENT)
+            byParent[fill[pool[pool[id].parent].firstVertex + pool[id].hingeEdge]++] = id;
+
+    // Depth-first order from the root, without recursion
+    std::vector<PolyId> order, stack(1, polygons.front());
+    std::vector<PolyId> newId(n);
+    order.reserve(n);
+    while (!stack.empty())
+    {
+        PolyId id = stack.back();
+        stack.pop_back();
+        newId[id] = static_cast<PolyId>(order.size());
+        order.push_back(id);
+        const Poly &poly = pool[id];
+        for (uint32_t i = slot[poly.firstVertex + poly.vertexCount]; i > slot[poly.firstVertex]; --i)
+            stack.push_back(byParent[i - 1]);
+    }
 
-    polygons.emplace_back(new Poly(*polygons.back(), std::pair<int, int>{3, 5}));
-    polygons.emplace_back(new Poly(*polygons.front(), std::pair<int, int>{3, 5}));
+    // Renumber the polygons and lay their vertices out in the same order
+    std::vector<Poly> sorted;
+    sorted.reserve(n);
+    VertexStore vertices;
+    foldChildren.clear();
+    for (PolyId id : order)
+    {
+        Poly poly = pool[id];
+        poly.firstVertex = vertices.size();
+        for (uint32_t i = 0; i < poly.vertexCount; ++i)
+            vertices.add(pool[id].vertex(i));
+        if (poly.parent != NO_PARENT)
+            poly.parent = newId[poly.parent];
+        poly.firstChild = static_cast<uint32_t>(foldChildren.size());
+        poly.childCount = slot[pool[id].firstVertex + poly.vertexCount] - slot[pool[id].firstVertex];
+        for (uint32_t i = 0; i < poly.childCount; ++i)
+            foldChildren.push_back(newId[byParent[slot[pool[id].firstVertex] + i]]);
+        poly.subtreeEnd = static_cast<PolyId>(sorted.size() + 1);
+        sorted.push_back(poly);
+    }
+    for (PolyId id = n; id-- > 1;)
+        sorted[sorted[id].parent].subtreeEnd = std::max(sorted[sorted[id].parent].subtreeEnd, sorted[id].subtreeEnd);
+
+    pool.swap(sorted);
+    vertexStore = vertices;
+    for (PolyId id = 0; id < n; ++id)
+        polygons[id] = id;
+    dirtyBegin = dirtyEnd = 0;
+}
 
-    foldingWait.push_back(polygons[0]);
-    build_buffer();
+// Recomputes the cached world transform of every dirty polygon and records it
+// in changedPolys. Dirty polygons all lie in [dirtyBegin, dirtyEnd) and
+// parents come before their children, so one forward sweep suffices.
+void update_world_transforms()
+{
+    for (PolyId id = dirtyBegin; id < dirtyEnd; ++id)
+    {
+        Poly &poly = polyArena.pool[id];
+        if (!poly.worldDirty)
+            continue;
+        poly.world = poly.parent == NO_PARENT ? poly.local : getPoly(poly.parent).world * poly.local;
+        poly.worldDirty = false;
+        changedPolys.push_back(id);
+    }
+    dirtyBegin = dirtyEnd = 0;
 }
 
-void build_octahedron_net()
+enum FoldCommand
 {
-    angle = acos(1.0f / 3.0f);
-    polygons.clear();
-    foldingWait.clear();
-    // Starting triangle
-    polygons.emplace_back(new Poly(cfloat(0.0f, 0.0f), 3, 2.0f, M_PI / 2.0f));
+    FOLD_NEXT,   // Fold the dependents of the next polygon in the frontier
+    FOLD_ALL,    // Keep folding until the frontier is empty
+    UNFOLD_LAST, // Undo the most recent FOLD_NEXT step
+    FOLD_RESET   // Back to the flat net
+};
+
+// Decides which polygon folds next. The frontier of polygons waiting to fold
+// their dependents is a ring buffer used as a deque, so every step is O(1)
+// plus the hinges it touches. Only polygons that have dependents ever enter
+// the frontier, and commands on an empty scheduler do nothing.
+struct FoldScheduler
+{
+    struct Step
+    {
+        PolyId poly;     // Polygon whose dependents were folded
+        uint32_t pushed; // How many of them were appended to the frontier
+    };
 
-    // Create net with alternating 3-2 triangle attachments
-    for (int edge : {3, 3, 3})
+    std::vector<PolyId> frontier; // Ring storage, one slot per polygon
+    uint32_t head = 0, count = 0;
+    std::vector<Step> history;
+    bool playing = false; // Animated FOLD_ALL: start the next step once the last one settles
+
+    void clear()
     {
-        polygons.emplace_back(new Poly(*polygons.back(), std::pair<int, int>{edge, 3}));
+        frontier.clear();
+        head = count = 0;
+        history.clear();
+        playing = false;
     }
 
-    polygons.emplace_back(new Poly(*polygons.front(), std::pair<int, int>{2, 3}));
-    for (int edge : {2, 3, 3})
+    // Starts folding from root; the net must be fully built
+    void reset(PolyId root)
     {
-        polygons.emplace_back(new Poly(*polygons.back(), std::pair<int, int>{edge, 3}));
+        clear();
+        frontier.resize(polyArena.pool.size());
+        if (getPoly(root).childCount > 0)
+            pushBack(root);
     }
 
-    foldingWait.push_back(polygons[0]);
-    // Extract line segments for rendering
-    build_buffer();
-}
+    bool empty() const
+    {
+        return count == 0;
+    }
 
-void build_hexahedron_net()
-{
-    angle = M_PI / 2.0f;
+    void pushBack(PolyId id)
+    {
+        frontier[(head + count) % frontier.size()] = id;
+        ++count;
+    }
 
-    polygons.clear();
-    foldingWait.clear();
+    void pushFront(PolyId id)
+    {
+        head = (head + frontier.size() - 1) % frontier.size();
+        frontier[head] = id;
+        ++count;
+    }
 
-    polygons.emplace_back(new Poly(cfloat(0.0f, 0.0f), 4, 2.0f, M_PI / 4.0f));
+    PolyId popFront()
+    {
+        PolyId id = frontier[head];
+        head = (head + 1) % frontier.size();
+        --count;
+        return id;
+    }
 
-    for (int edge : {2, 3, 3})
-        polygons.emplace_back(new Poly(*polygons.back(), std::pair<int, int>{edge, 4}));
+    void popBack(uint32_t n)
+    {
+        count -= n;
+    }
 
-    polygons.emplace_back(new Poly(*polygons.back(), std::pair<int, int>{4, 4}));
-    polygons.emplace_back(new Poly(*polygons.front(), std::pair<int, int>{1, 4}));
+    bool foldNext()
+    {
+        if (empty())
+            return false;
+        PolyId id = popFront();
+        Poly &poly = getPoly(id);
+        poly.foldDependents();
+
+        Step step{id, 0};
+        for (uint32_t i = 0; i < poly.childCount; ++i)
+            if (getPoly(poly.child(i)).childCount > 0)
+            {
+                pushBack(poly.child(i));
+                ++step.pushed;
+            }
+        history.push_back(step);
+        return true;
+    }
 
-    foldingWait.push_back(polygons[0]);
-    build_buffer();
-}
+    // Steps are undone last-first, so the polygons a step appended are still
+    // the last ones in the frontier when it is undone
+    bool unfoldLast()
+    {
+        if (history.empty())
+            return false;
+        Step step = history.back();
+        history.pop_back();
+        popBack(step.pushed);
+        getPoly(step.poly).unfoldDependents();
+        pushFront(step.poly);
+        return true;
+    }
 
-void build_tetrahedron_net()
+    void execute(FoldCommand command)
+    {
+        playing = false;
+        switch (command)
+        {
+        case FOLD_NEXT:
+            foldNext();
+            break;
+        case FOLD_ALL:
+            if (animateFolds)
+                playing = foldNext();
+            else
+                while (foldNext())
+                    ;
+            break;
+        case UNFOLD_LAST:
+            unfoldLast();
+            break;
+        case FOLD_RESET:
+            while (unfoldLast())
+                ;
+            break;
+        }
+    }
+};
+
+FoldScheduler foldScheduler;
+
+// Moves every animating hinge on by dt seconds; a playing FOLD_ALL starts
+// its next step as soon as the previous one has settled
+void advance_fold_animation(float dt)
 {
-    angle = acos(-1.0f / 3.0f);
-    polygons.clear();
-    foldingWait.clear();
-    // Starting triangle
-    polygons.emplace_back(new Poly(cfloat(0.0f, 0.0f), 3, 2.0f, M_PI / 2.0f));
-    polygons.emplace_back(new Poly(*polygons.front(), std::pair<int, int>{1, 3}));
-    polygons.emplace_back(new Poly(*polygons.front(), std::pair<int, int>{2, 3}));
-    polygons.emplace_back(new Poly(*polygons.front(), std::pair<int, int>{3, 3}));
-    foldingWait.push_back(polygons[0]);
-    // Extract line segments for rendering
-    build_buffer();
+    float step = dt / foldDuration;
+    size_t kept = 0;
+    for (PolyId id : animatingHinges)
+    {
+        Poly &hinge = getPoly(id);
+        if (hinge.foldProgress < hinge.foldTarget)
+            hinge.setFoldProgress(std::min(hinge.foldProgress + step, hinge.foldTarget));
+        else if (hinge.foldProgress > hinge.foldTarget)
+            hinge.setFoldProgress(std::max(hinge.foldProgress - step, hinge.foldTarget));
+
+        if (hinge.foldProgress == hinge.foldTarget)
+            hinge.animating = false;
+        else
+            animatingHinges[kept++] = id;
+    }
+    animatingHinges.resize(kept);
+
+    if (foldScheduler.playing && animatingHinges.empty())
+        foldScheduler.playing = foldScheduler.foldNext();
 }
-// Add these global variables
-unsigned int faceVAO, faceVBO;
-std::vector<float> faceBuffer;
 
-void build_buffer()
+// Closed-form schedule of an animated FOLD_ALL from the flat net: step k of
+// the scheduler's order moves its polygon's dependents during
+// [k, k + 1) * foldDuration. Any instant is evaluated directly from the
+// hinge axes, so frames can be sought or rendered in any order.
+struct FoldTimeline
 {
-    // Clear existing buffers
-    buffer.clear();
-    faceBuffer.clear();
+    std::vector<uint32_t> step; // Step during which each hinge folds, by child id
+    uint32_t steps = 0;
 
-    for (const auto &poly : polygons)
+    // Replays the scheduler's breadth-first order; the net must be fully built
+    void build(PolyId root)
     {
-        for (size_t i = 0; i < poly->vertices.size() - 1; ++i)
+        step.assign(polyArena.pool.size(), 0);
+        steps = 0;
+        std::vector<PolyId> order;
+        if (getPoly(root).childCount > 0)
+            order.push_back(root);
+        for (size_t k = 0; k < order.size(); ++k, ++steps)
         {
-            buffer.push_back(poly->vertices[i].x);
-            buffer.push_back(poly->vertices[i].y);
-            buffer.push_back(poly->vertices[i].z);
-            buffer.push_back(poly->vertices[i + 1].x);
-            buffer.push_back(poly->vertices[i + 1].y);
-            buffer.push_back(poly->vertices[i + 1].z);
+            const Poly &poly = getPoly(order[k]);
+            for (uint32_t i = 0; i < poly.childCount; ++i)
+            {
+                step[poly.child(i)] = steps;
+                if (getPoly(poly.child(i)).childCount > 0)
+                    order.push_back(poly.child(i));
+            }
         }
+    }
+
+    float length() const
+    {
+        return steps * foldDuration;
+    }
 
-        // 2. Add faces to face buffer
-        for (const auto &vertex : poly->faceVertices)
+    float progress(PolyId id, float time) const
+    {
+        return glm::clamp(time / foldDuration - float(step[id]), 0.0f, 1.0f);
+    }
+
+    // World transform of every polygon at the given time. Only reads the
+    // net, so several threads can evaluate different times at once.
+    void evaluate(float time, std::vector<glm::mat4> &world) const
+    {
+        world.resize(polyArena.pool.size());
+        for (PolyId id = 0; id < world.size(); ++id)
         {
-            faceBuffer.push_back(vertex.x);
-            faceBuffer.push_back(vertex.y);
-            faceBuffer.push_back(vertex.z);
+            const Poly &poly = polyArena.pool[id];
+            if (poly.parent == NO_PARENT)
+                world[id] = glm::mat4(1.0f);
+            else
+                world[id] = world[poly.parent] * poly.hingeTransform(poly.foldAngle * progress(id, time));
         }
     }
+};
 
-}
+FoldTimeline foldTimeline;
 
-void display_polygons(){
-    // Update line VBO
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, buffer.size() * sizeof(float), buffer.data(), GL_DYNAMIC_DRAW);
+// Flattens the finished net and queues its first upload; called at the end of
+// every build_*_net()
+void finish_net()
+{
+    build_fold_tree();
+    foldScheduler.reset(polygons[0]);
+    foldTimeline.build(polygons[0]);
+    build_buffer_layout();
+}
 
-    // Update face VBO
-    glBindBuffer(GL_ARRAY_BUFFER, faceVBO);
-    glBufferData(GL_ARRAY_BUFFER, faceBuffer.size() * sizeof(float), faceBuffer.data(), GL_DYNAMIC_DRAW);
+// Drops the previous net before a build_*_net() starts a new one
+void reset_net()
+{
+    polygons.clear();
+    foldScheduler.clear();
+    animatingHinges.clear();
+    polyArena.reset();
+    vertexStore.reset();
 }
 
-// Handle keyboard input for camera movement
-void processInput(GLFWwindow *window)
+// A polyhedron as the net generator sees it. Faces are loops of vertex indices,
+// counterclockwise seen from outside; edge k of face f runs from corner k to
+// corner k + 1 and is half-edge faceStart[f] + k. build_adjacency() fills in,
+// for every half-edge, the matching half-edge of the neighbouring face and the
+// dihedral angle between the two faces.
+struct PolyhedronDesc
 {
-    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-        glfwSetWindowShouldClose(window, true);
-    if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> faceStart = {0}; // Face f owns corners [faceStart[f], faceStart[f + 1])
+    std::vector<uint32_t> corners;         // Vertex index of every face corner
+    std::vector<uint32_t> edgeFace;        // Face owning each half-edge
+    std::vector<uint32_t> twin;            // Opposite half-edge on the neighbouring face
+    std::vector<float> dihedral;           // Interior dihedral angle at each half-edge
+    bool closed = false;                   // build_adjacency() found a twin for every half-edge
+
+    uint32_t faceCount() const
     {
-        switch (whatIsMoving)
-        {
-        case CAM:
-            camY += camSpeed;
-            break;
-        case CENTER:
-            centerY += centerSpeed;
-            break;
-        case VERTICES:
-            for (int i = 1; i < buffer.size(); i += 3)
-            {
-                buffer[i] += vertexSpeed;
-            }
-            for(int i = 1; i < faceBuffer.size(); i += 3)
-            {
-                faceBuffer[i] += vertexSpeed;
-            }
-        }
+        return static_cast<uint32_t>(faceStart.size() - 1);
     }
-    if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
+
+    uint32_t sides(uint32_t f) const
     {
-        switch (whatIsMoving)
-        {
-        case CAM:
-            camY -= camSpeed;
-            break;
-        case CENTER:
-            centerY -= centerSpeed;
-            break;
-        case VERTICES:
-            for (int i = 1; i < buffer.size(); i += 3)
-            {
-                buffer[i] -= vertexSpeed;
-            }
-            for(int i = 1; i < faceBuffer.size(); i += 3)
-            {
-                faceBuffer[i] -= vertexSpeed;
-            }
-        }
+        return faceStart[f + 1] - faceStart[f];
     }
-    if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+
+    // Half-edge for edge k of face f
+    uint32_t halfEdge(uint32_t f, uint32_t k) const
     {
-        switch (whatIsMoving)
-        {
-        case CAM:
-            camX -= camSpeed;
-            break;
-        case CENTER:
-            centerX -= centerSpeed;
-            break;
-        case VERTICES:
-            for (int i = 0; i < buffer.size(); i += 3)
-            {
-                buffer[i] -= vertexSpeed;
-            }
-            for(int i = 0; i < faceBuffer.size(); i += 3)
-            {
-                faceBuffer[i] -= vertexSpeed;
-            }
-        }
+        return faceStart[f] + k % sides(f);
     }
-    if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+
+    glm::vec3 corner(uint32_t f, uint32_t k) const
     {
-        switch (whatIsMoving)
+        return vertices[corners[halfEdge(f, k)]];
+    }
+
+    void addFace(const std::vector<uint32_t> &loop)
+    {
+        corners.insert(corners.end(), loop.begin(), loop.end());
+        faceStart.push_back(static_cast<uint32_t>(corners.size()));
+    }
+
+    glm::vec3 faceNormal(uint32_t f) const
+    {
+        // Newell's method, robust for any planar polygon
+        glm::vec3 n(0.0f);
+        for (uint32_t k = 0; k < sides(f); ++k)
         {
-        case CAM:
-            camX += camSpeed;
-            break;
-        case CENTER:
-            centerX += centerSpeed;
-            break;
-        case VERTICES:
-            std :: cout << "Translating" << std :: endl;
-            for (int i = 0; i < buffer.size(); i += 3)
-            {
-                buffer[i] += vertexSpeed;
-            }
-            for(int i = 0; i < faceBuffer.size(); i += 3)
-            {
-                faceBuffer[i] += vertexSpeed;
-            }
+            glm::vec3 a = corner(f, k), b = corner(f, k + 1);
+            n += glm::vec3((a.y - b.y) * (a.z + b.z), (a.z - b.z) * (a.x + b.x), (a.x - b.x) * (a.y + b.y));
         }
+        return glm::normalize(n);
     }
-    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+
+    glm::vec3 faceCentroid(uint32_t f) const
     {
+        glm::vec3 c(0.0f);
+        for (uint32_t k = 0; k < sides(f); ++k)
+            c += corner(f, k);
+        return c / float(sides(f));
+    }
+};
 
-        switch (whatIsMoving)
+// Turns every face loop counterclockwise as seen from outside. Good for any
+// convex solid, which covers the Platonic, Archimedean, Johnson and geodesic
+// families.
+void orient_faces(PolyhedronDesc &desc)
+{
+    glm::vec3 middle(0.0f);
+    for (const glm::vec3 &v : desc.vertices)
+        middle += v;
+    middle /= float(desc.vertices.size());
+    for (uint32_t f = 0; f < desc.faceCount(); ++f)
+        if (glm::dot(desc.faceNormal(f), desc.faceCentroid(f) - middle) < 0.0f)
+            std::reverse(desc.corners.begin() + desc.faceStart[f], desc.corners.begin() + desc.faceStart[f + 1]);
+}
+
+// Pairs up the half-edges of neighbouring faces through a hash of their
+// endpoints and measures the dihedral angle at each edge, in linear time.
+// Fails if the surface is not closed.
+bool build_adjacency(PolyhedronDesc &desc)
+{
+    desc.closed = false;
+    size_t halfEdges = desc.corners.size();
+    desc.edgeFace.resize(halfEdges);
+    desc.twin.assign(halfEdges, 0);
+    desc.dihedral.assign(halfEdges, 0.0f);
+
+    std::unordered_map<uint64_t, uint32_t> byEndpoints;
+    byEndpoints.reserve(halfEdges);
+    for (uint32_t f = 0; f < desc.faceCount(); ++f)
+    {
+        for (uint32_t k = 0; k < desc.sides(f); ++k)
         {
-        case CAM:
-            camZ -= camSpeed;
-            break;
-        case CENTER:
-            centerZ -= centerSpeed;
-            break;
-        case VERTICES:
-            for (int i = 2; i < buffer.size(); i += 3)
-            {
-                buffer[i] -= vertexSpeed;
-            }
-            for(int i = 2; i < faceBuffer.size(); i += 3)
-            {
-                faceBuffer[i] -= vertexSpeed;
-            }
+            uint32_t h = desc.halfEdge(f, k);
+            uint64_t a = desc.corners[h], b = desc.corners[desc.halfEdge(f, k + 1)];
+            desc.edgeFace[h] = f;
+            byEndpoints[a << 32 | b] = h;
         }
     }
-    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    for (uint32_t f = 0; f < desc.faceCount(); ++f)
     {
-        switch (whatIsMoving)
+        for (uint32_t k = 0; k < desc.sides(f); ++k)
         {
-        case CAM:
-            camZ += camSpeed;
-            break;
-        case CENTER:
-            centerZ += centerSpeed;
-            break;
-        case VERTICES:
-            std :: cout << "Translation" << std::endl;
-            for (int i = 2; i < buffer.size(); i += 3)
-            {
-                buffer[i] += vertexSpeed;
-            }
-            for(int i = 2; i < faceBuffer.size(); i += 3)
+            uint32_t h = desc.halfEdge(f, k);
+            uint64_t a = desc.corners[h], b = desc.corners[desc.halfEdge(f, k + 1)];
+            auto match = byEndpoints.find(b << 32 | a);
+            if (match == byEndpoints.end())
             {
-                faceBuffer[i] += vertexSpeed;
+                std::cout << "ERROR::POLYHEDRON: edge " << a << "-" << b << " has only one face" << std::endl;
+                return false;
             }
+            desc.twin[h] = match->second;
+
+            // The fold angle is the angle between the two face normals; it
+            // is negative where the neighbour bends outwards (a concave edge)
+            uint32_t g = desc.edgeFace[match->second];
+            glm::vec3 nf = desc.faceNormal(f), ng = desc.faceNormal(g);
+            float fold = std::acos(glm::clamp(glm::dot(nf, ng), -1.0f, 1.0f));
+            if (glm::dot(nf, desc.faceCentroid(g) - desc.faceCentroid(f)) > 0.0f)
+                fold = -fold;
+            desc.dihedral[h] = float(M_PI) - fold;
         }
     }
-    if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS)
+    desc.closed = true;
+    return true;
+}
+
+// Vertex positions plus faces listed in any orientation; desc.closed says
+// whether the faces made a closed surface
+PolyhedronDesc make_polyhedron(const std::vector<glm::vec3> &vertices, const std::vector<std::vector<uint32_t>> &faces)
+{
+    PolyhedronDesc desc;
+    desc.vertices = vertices;
+    for (const auto &face : faces)
+        desc.addFace(face);
+    orient_faces(desc);
+    build_adjacency(desc);
+    return desc;
+}
+
+// Swaps faces and vertices: one vertex per face centroid, one face per vertex
+// ringed by the faces around it
+PolyhedronDesc dual_polyhedron(const PolyhedronDesc &desc)
+{
+    std::vector<glm::vec3> vertices;
+    for (uint32_t f = 0; f < desc.faceCount(); ++f)
+        vertices.push_back(desc.faceCentroid(f));
+
+    // Walking outgoing half-edges around a vertex visits its faces in order
+    std::vector<uint32_t> outgoing(desc.vertices.size());
+    for (uint32_t h = 0; h < desc.corners.size(); ++h)
+        outgoing[desc.corners[h]] = h;
+    std::vector<std::vector<uint32_t>> faces;
+    for (uint32_t v = 0; v < desc.vertices.size(); ++v)
     {
-        if (whatIsMoving == CAM)
-            whatIsMoving = CENTER;
-        else if (whatIsMoving == CENTER)
-            whatIsMoving = CAM;
-        else if (whatIsMoving == VERTICES)
-            whatIsMoving = CAM;
+        std::vector<uint32_t> ring;
+        uint32_t h = outgoing[v];
+        do
+        {
+            uint32_t f = desc.edgeFace[h];
+            ring.push_back(f);
+            // Previous half-edge of f ends at v; its twin leaves v
+            h = desc.twin[desc.halfEdge(f, h - desc.faceStart[f] + desc.sides(f) - 1)];
+        } while (h != outgoing[v]);
+        faces.push_back(ring);
     }
-    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS)
+    return make_polyhedron(vertices, faces);
+}
+
+PolyhedronDesc tetrahedron_desc()
+{
+    return make_polyhedron({{1, 1, 1}, {1, -1, -1}, {-1, 1, -1}, {-1, -1, 1}},
+                           {{0, 1, 2}, {0, 1, 3}, {0, 2, 3}, {1, 2, 3}});
+}
+
+PolyhedronDesc hexahedron_desc()
+{
+    // Vertex index bits are (x > 0, y > 0, z > 0)
+    std::vector<glm::vec3> vertices;
+    for (int i = 0; i < 8; ++i)
+        vertices.emplace_back(i & 4 ? 1 : -1, i & 2 ? 1 : -1, i & 1 ? 1 : -1);
+    return make_polyhedron(vertices, {{0, 1, 3, 2}, {4, 6, 7, 5}, {0, 4, 5, 1}, {2, 3, 7, 6}, {0, 2, 6, 4}, {1, 5, 7, 3}});
+}
+
+PolyhedronDesc octahedron_desc()
+{
+    return make_polyhedron({{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}},
+                           {{0, 2, 4}, {0, 2, 5}, {0, 3, 4}, {0, 3, 5}, {1, 2, 4}, {1, 2, 5}, {1, 3, 4}, {1, 3, 5}});
+}
+
+PolyhedronDesc icosahedron_desc()
+{
+    const float phi = (1.0f + std::sqrt(5.0f)) / 2.0f;
+    std::vector<glm::vec3> vertices;
+    for (float s : {-1.0f, 1.0f})
+        for (float t : {-1.0f, 1.0f})
+        {
+            vertices.emplace_back(0, s, t * phi);
+            vertices.emplace_back(s, t * phi, 0);
+            vertices.emplace_back(t * phi, 0, s);
+        }
+
+    // Faces are the triples of mutually adjacent vertices (edge length 2)
+    auto adjacent = [&](int a, int b) { return std::abs(glm::distance(vertices[a], vertices[b]) - 2.0f) < 1e-3f; };
+    std::vector<std::vector<uint32_t>> faces;
+    for (uint32_t a = 0; a < 12; ++a)
+        for (uint32_t b = a + 1; b < 12; ++b)
+            for (uint32_t c = b + 1; c < 12; ++c)
+                if (adjacent(a, b) && adjacent(b, c) && adjacent(a, c))
+                    faces.push_back({a, b, c});
+    return make_polyhedron(vertices, faces);
+}
+
+PolyhedronDesc dodecahedron_desc()
+{
+    return dual_polyhedron(icosahedron_desc());
+}
+
+// Cuts every vertex off at fraction t of each edge. Each face keeps a shrunk
+// copy and each vertex becomes a new face. t = 1/3 gives the truncated solids,
+// and t = 1/2 (rectification) merges the two cuts on an edge into one vertex.
+PolyhedronDesc truncate_polyhedron(const PolyhedronDesc &desc, float t)
+{
+    bool rectify = std::abs(t - 0.5f) < 1e-6f;
+
+    // One new vertex per half-edge, near its start
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> cut(desc.corners.size());
+    for (uint32_t f = 0; f < desc.faceCount(); ++f)
+        for (uint32_t k = 0; k < desc.sides(f); ++k)
+        {
+            uint32_t h = desc.halfEdge(f, k);
+            if (rectify && desc.twin[h] < h)
+            {
+                cut[h] = cut[desc.twin[h]];
+                continue;
+            }
+            cut[h] = static_cast<uint32_t>(vertices.size());
+            vertices.push_back(glm::mix(desc.corner(f, k), desc.corner(f, k + 1), t));
+        }
+
+    std::vector<std::vector<uint32_t>> faces;
+    for (uint32_t f = 0; f < desc.faceCount(); ++f)
     {
-        if (whatIsMoving != VERTICES)
-            whatIsMoving = VERTICES;
-        else
-            whatIsMoving = CAM;
+        std::vector<uint32_t> loop;
+        for (uint32_t k = 0; k < desc.sides(f); ++k)
+        {
+            uint32_t h = desc.halfEdge(f, k);
+            loop.push_back(cut[h]);
+            if (!rectify)
+                loop.push_back(cut[desc.twin[h]]);
+        }
+        faces.push_back(loop);
     }
-    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS)
+
+    // Walk the outgoing half-edges around each old vertex, as dual_polyhedron does
+    std::vector<uint32_t> outgoing(desc.vertices.size());
+    for (uint32_t h = 0; h < desc.corners.size(); ++h)
+        outgoing[desc.corners[h]] = h;
+    for (uint32_t v = 0; v < desc.vertices.size(); ++v)
     {
-        if (whatIsMoving == CAM)
+        std::vector<uint32_t> loop;
+        uint32_t h = outgoing[v];
+        do
         {
-            camX = 0.0f;
-            camY = 0.0f;
-            camZ = 20.0f;
+            loop.push_back(cut[h]);
+            uint32_t f = desc.edgeFace[h];
+            h = desc.twin[desc.halfEdge(f, h - desc.faceStart[f] + desc.sides(f) - 1)];
+        } while (h != outgoing[v]);
+        faces.push_back(loop);
+    }
+    return make_polyhedron(vertices, faces);
+}
+
+// Reads a polyhedron from an OFF file, the format used by most polyhedron
+// collections (Archimedean, Johnson, geodesic solids, ...)
+bool load_off_polyhedron(const char *path, PolyhedronDesc &desc)
+{
+    std::ifstream in(path);
+    std::string header;
+    if (!(in >> header) || header != "OFF")
+    {
+        std::cout << "ERROR::POLYHEDRON: " << path << " is not an OFF file" << std::endl;
+        return false;
+    }
+    auto skipComments = [&]() {
+        while ((in >> std::ws).peek() == '#')
+            in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    };
+    size_t vertexCount = 0, faceCount = 0, edgeCount = 0;
+    skipComments();
+    if (!(in >> vertexCount >> faceCount >> edgeCount))
+    {
+        std::cout << "ERROR::POLYHEDRON: " << path << " has a bad header" << std::endl;
+        return false;
+    }
+
+    // The counts are not trusted with an allocation: the lists grow as the
+    // file delivers, so a huge count just runs into the end of the file
+    std::vector<glm::vec3> vertices;
+    for (size_t i = 0; i < vertexCount && in; ++i)
+    {
+        glm::vec3 v;
+        skipComments();
+        if (in >> v.x >> v.y >> v.z)
+            vertices.push_back(v);
+        in.ignore(std::numeric_limits<std::streamsize>::max(), '\n'); // Optional colour
+    }
+    std::vector<std::vector<uint32_t>> faces;
+    for (size_t i = 0; i < faceCount && in; ++i)
+    {
+        size_t sides = 0;
+        skipComments();
+        in >> sides;
+        if (!in)
+            break;
+        faces.emplace_back();
+        std::vector<uint32_t> &face = faces.back();
+        bool bad = sides < 3 || sides > vertices.size();
+        if (!bad)
+        {
+            face.resize(sides);
+            for (uint32_t &v : face)
+                bad = bad || !(in >> v) || v >= vertices.size();
         }
-        else if (whatIsMoving == CENTER)
+        if (bad && in)
         {
-            centerX = 0.0f;
-            centerY = 0.0f;
-            centerZ = 0.0f;
+            std::cout << "ERROR::POLYHEDRON: " << path << " has a bad face" << std::endl;
+            return false;
         }
+        in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+    }
+    if (!in)
+    {
+        std::cout << "ERROR::POLYHEDRON: " << path << " is truncated" << std::endl;
+        return false;
     }
-    static bool spaceWasPressed = false;
-    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
-        spaceWasPressed = false;
-    bool spacePressed = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
 
-    if (spacePressed && !spaceWasPressed)
+    desc = PolyhedronDesc();
+    desc.vertices = vertices;
+    for (const auto &face : faces)
+        desc.addFace(face);
+    orient_faces(desc);
+    return build_adjacency(desc);
+}
+
+// Flat-net corners of face f, starting at corner first, in the face's own
+// plane: corner first at the origin and the next one on the positive real axis
+std::vector<cfloat> flatten_face(const PolyhedronDesc &desc, uint32_t f, uint32_t first)
+{
+    glm::vec3 origin = desc.corner(f, first);
+    glm::vec3 u = glm::normalize(desc.corner(f, first + 1) - origin);
+    glm::vec3 w = glm::cross(desc.faceNormal(f), u);
+    std::vector<cfloat> points;
+    for (uint32_t k = 0; k < desc.sides(f); ++k)
     {
-        Poly *poly;
-        if (foldingWait.size() == 0)
-            return;
-        do
+        glm::vec3 d = desc.corner(f, first + k) - origin;
+        points.emplace_back(glm::dot(d, u), glm::dot(d, w));
+    }
+    return points;
+}
+
+// Unfolds a polyhedron into a net along a breadth-first spanning tree of its
+// faces, starting from face 0, and lays out the fold schedule for it. Every
+// face is visited once and every half-edge looked at once, so the net builds in
+// linear time. Fails, keeping the current net, if desc is empty or not closed.
+bool build_net(const PolyhedronDesc &desc)
+{
+    if (desc.faceCount() == 0)
+    {
+        std::cout << "ERROR::POLYHEDRON: no faces to unfold" << std::endl;
+        return false;
+    }
+    if (!desc.closed)
+    {
+        std::cout << "ERROR::POLYHEDRON: faces do not form a closed surface" << std::endl;
+        return false;
+    }
+    reset_net();
+
+    // The root face keeps the size of the old hand-built nets (circumradius 2)
+    // with its first corner pointing up
+    std::vector<cfloat> root = flatten_face(desc, 0, 0);
+    cfloat middle(0.0f, 0.0f);
+    for (cfloat p : root)
+        middle += p;
+    middle /= float(root.size());
+    cfloat toFirst = root[0] - middle;
+    float scale = 2.0f / std::abs(toFirst);
+    cfloat turn = cfloat(0.0f, 1.0f) * std::abs(toFirst) / toFirst;
+    for (cfloat &p : root)
+        p = (p - middle) * turn * scale;
+
+    // Which polygon each face became, and which face corner is its vertex 0
+    std::vector<PolyId> facePoly(desc.faceCount(), NO_PARENT);
+    std::vector<uint32_t> faceFirst(desc.faceCount(), 0);
+    std::vector<uint32_t> queue(1, 0);
+    facePoly[0] = polyArena.create(root);
+    polygons.push_back(facePoly[0]);
+
+    for (size_t next = 0; next < queue.size(); ++next)
+    {
+        uint32_t f = queue[next];
+        PolyId parent = facePoly[f];
+        for (uint32_t edge = 0; edge < desc.sides(f); ++edge)
         {
-            poly = foldingWait.front();
-            foldingWait.erase(foldingWait.begin());
-        } while (poly->dependentsCount == 0);
-        poly->foldDependents(angle);
-        spaceWasPressed = true;
+            uint32_t twin = desc.twin[desc.halfEdge(f, faceFirst[f] + edge)];
+            uint32_t g = desc.edgeFace[twin];
+            if (facePoly[g] != NO_PARENT)
+                continue;
+
+            // The shared edge runs a -> b on the parent and b -> a on g, so g
+            // starts at b and is turned and scaled onto the parent's edge
+            const Poly &p = getPoly(parent);
+            glm::vec3 a3 = p.vertex(edge), b3 = p.vertex(edge + 1);
+            cfloat a(a3.x, a3.y), b(b3.x, b3.y);
+            faceFirst[g] = twin - desc.faceStart[g];
+            std::vector<cfloat> points = flatten_face(desc, g, faceFirst[g]);
+            cfloat along = (a - b) / points[1];
+            for (cfloat &q : points)
+                q = b + q * along;
+            points[0] = b;
+            points[1] = a;
+
+            facePoly[g] = polyArena.attach(parent, edge, points);
+            getPoly(facePoly[g]).foldAngle = float(M_PI) - desc.dihedral[twin];
+            polygons.push_back(facePoly[g]);
+            queue.push_back(g);
+        }
     }
+    if (queue.size() < desc.faceCount())
+        std::cout << "WARNING::POLYHEDRON: " << desc.faceCount() - queue.size()
+                  << " faces are not connected to face 0 and were left out" << std::endl;
+
+    finish_net();
+    return true;
 }
-// Detect click within UI menu area
-void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
+
+void build_tetrahedron_net()
 {
-    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    build_net(tetrahedron_desc());
+}
+
+void build_hexahedron_net()
+{
+    build_net(hexahedron_desc());
+}
+
+void build_octahedron_net()
+{
+    build_net(octahedron_desc());
+}
+
+void build_dodecahedron_net()
+{
+    build_net(dodecahedron_desc());
+}
+
+void build_icosahedron_net()
+{
+    build_net(icosahedron_desc());
+}
+
+void build_cuboctahedron_net()
+{
+    build_net(truncate_polyhedron(hexahedron_desc(), 0.5f));
+}
+
+void build_truncated_icosahedron_net()
+{
+    build_net(truncate_polyhedron(icosahedron_desc(), 1.0f / 3.0f));
+}
+
+// A welded flat-net vertex and the polygon whose transform places it
+struct NetVertex
+{
+    glm::vec3 position;
+    uint32_t poly;
+};
+
+// One corner of a face triangle for the single-pass wireframe. Corners are
+// not shared between triangles, so each knows its barycentric role.
+struct WireVertex
+{
+    glm::vec3 position;
+    uint32_t poly;
+    uint32_t corner; // Corner 0-2; bit 2 + k is set when the edge opposite corner k is a fan diagonal
+};
+
+// Add these global variables
+unsigned int faceVAO, faceEBO;
+unsigned int wireVAO, wireVBO;
+std::vector<WireVertex> wireBuffer;
+bool wireUploadPending = false;    // wireBuffer is stale; rebuilt when wireframe mode draws
+unsigned int paletteBuffer, paletteTexture;
+std::vector<NetVertex> buffer;     // Welded vertex pool, shared by every polygon touching a vertex
+std::vector<uint32_t> edgeIndices; // Line list into buffer, each hinge edge once
+std::vector<uint32_t> faceIndices; // Triangle list into buffer, a fan per polygon
+std::vector<glm::mat4> palette;    // World transform of every polygon, by id
+bool netUploadPending = false;     // The net changed; vertices and indices must be re-sent
+
+// Welds the net into a shared vertex pool and builds the index buffers. A
+// child polygon's first two vertices are its parent's hinge edge walked
+// backwards, and the hinge stays put while the child folds, so those two
+// are shared with the parent in every fold state. Vertices meeting across a
+// cut edge only coincide once the net is closed, so they are not welded.
+// Vertices hold flat-net positions and are placed on the GPU by their
+// owner's palette entry, so they are uploaded once per net and a fold only
+// sends the matrices of the polygons that moved.
+void build_buffer_layout()
+{
+    static std::vector<uint32_t> weldIndex; // Welded vertex of every vertexStore entry
+    uint32_t weldSize = 0;
+    weldIndex.assign(vertexStore.size(), 0);
+    buffer.clear();
+    edgeIndices.clear();
+    faceIndices.clear();
+    for (PolyId id : polygons)
     {
-        double xpos, ypos;
-        glfwGetCursorPos(window, &xpos, &ypos);
-        if (xpos < 100)
+        Poly &poly = getPoly(id);
+        uint32_t n = poly.vertexCount;
+        uint32_t *weld = weldIndex.data() + poly.firstVertex;
+
+        // Hinge endpoints come from the parent, which has a lower id
+        bool hinged = false;
+        if (poly.parent != NO_PARENT)
         {
-            int boxIndex = static_cast<int>(ypos / 60);
-            if (boxIndex >= 0 && boxIndex < 5)
+            const Poly &p = getPoly(poly.parent);
+            uint32_t a = poly.hingeEdge, b = (poly.hingeEdge + 1) % p.vertexCount;
+            hinged = glm::distance(poly.vertex(0), p.vertex(b)) < 1e-4f &&
+                     glm::distance(poly.vertex(1), p.vertex(a)) < 1e-4f;
+            if (hinged)
             {
-                std::cout << "Clicked on solid box: " << boxIndex << std::endl;
-                switch (boxIndex)
-                {
-                case 0:
-                    build_tetrahedron_net();
-                    break;
-                case 1:
-                    build_hexahedron_net();
-                    break;
-                case 2:
-                    build_octahedron_net();
-                    break;
-                case 3:
-                    build_dodecahedron_net();
-                    break;
-                case 4:
-                    build_icosahedron_net();
-                    break;
-                }
+                weld[0] = weldIndex[p.firstVertex + b];
+                weld[1] = weldIndex[p.firstVertex + a];
+            }
+        }
+        for (uint32_t i = hinged ? 2 : 0; i < n; ++i)
+        {
+            weld[i] = weldSize++;
+            buffer.push_back({poly.vertex(i), id});
+        }
+
+        // Edges, leaving out the hinge the parent already draws
+        for (uint32_t i = hinged ? 1 : 0; i < n; ++i)
+        {
+            edgeIndices.push_back(weld[i]);
+            edgeIndices.push_back(weld[(i + 1) % n]);
+        }
+        // Faces as a fan around vertex 0
+        for (uint32_t i = 1; i + 1 < n; ++i)
+        {
+            faceIndices.push_back(weld[0]);
+            faceIndices.push_back(weld[i]);
+            faceIndices.push_back(weld[i + 1]);
+        }
+        poly.worldDirty = true;
+    }
+    palette.assign(polygons.size(), glm::mat4(1.0f));
+    changedPolys.clear();
+    dirtyBegin = 0;
+    dirtyEnd = static_cast<PolyId>(polygons.size());
+
+    buffersDirty = true;
+    fullUploadPending = true;
+    netUploadPending = true;
+}
+
+// Outline flags of fan triangle i of an n-gon: bit k is set when the
+// edge opposite corner k is a diagonal. Edge (i, i + 1) is always on the
+// outline; the other two only for the first and last triangle of the fan.
+uint32_t fan_diagonals(uint32_t i, uint32_t n)
+{
+    return (i + 2 < n ? 2u : 0u) | (i > 1 ? 4u : 0u);
+}
+
+// Expands the face fans into independent triangles for the wireframe mode
+void build_wire_buffer()
+{
+    wireBuffer.clear();
+    const uint32_t *tri = faceIndices.data();
+    for (PolyId id : polygons)
+    {
+        uint32_t n = getPoly(id).vertexCount;
+        for (uint32_t i = 1; i + 1 < n; ++i, tri += 3)
+        {
+            uint32_t diagonals = fan_diagonals(i, n);
+            for (uint32_t k = 0; k < 3; ++k)
+                wireBuffer.push_back({buffer[tri[k]].position, buffer[tri[k]].poly, k | diagonals << 2});
+        }
+    }
+}
+
+// Refreshes the palette entry of every polygon whose world transform changed
+void build_buffer()
+{
+    size_t alreadyChanged = changedPolys.size();
+    update_world_transforms();
+    for (size_t i = alreadyChanged; i < changedPolys.size(); ++i)
+        palette[changedPolys[i]] = getPoly(changedPolys[i]).world;
+}
+
+// GL_ARB_buffer_storage is not part of the 3.3 core profile glad loads, so its
+// entry point is fetched at startup when the driver advertises it
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void(APIENTRYP PFNGLBUFFERSTORAGEARBPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+PFNGLBUFFERSTORAGEARBPROC glBufferStorageARB = nullptr;
+
+// Streams vertex data to the GPU through a triple-buffered staging ring. Each
+// frame writes into its own segment and copies from there into the target
+// buffer on the GPU. The fence placed at the end of the frame keeps the CPU
+// from reusing a segment before that copy has executed, so drawing never
+// waits on a buffer the GPU is still reading.
+struct StreamUploader
+{
+    static const int SEGMENTS = 3;
+
+    GLuint staging = 0;
+    GLsizeiptr segmentSize = 0;
+    char *mapped = nullptr; // Persistent mapping of the whole ring, if supported
+    GLsync fences[SEGMENTS] = {};
+    int segment = 0;
+    GLsizeiptr used = 0;    // Bytes written into the current segment
+    bool segmentReady = false;
+
+    void init(GLsizeiptr bytesPerFrame)
+    {
+        segmentSize = bytesPerFrame;
+        glGenBuffers(1, &staging);
+        glBindBuffer(GL_COPY_READ_BUFFER, staging);
+        if (glBufferStorageARB)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorageARB(GL_COPY_READ_BUFFER, segmentSize * SEGMENTS, nullptr, flags);
+            mapped = static_cast<char *>(glMapBufferRange(GL_COPY_READ_BUFFER, 0, segmentSize * SEGMENTS, flags));
+        }
+        else
+        {
+            glBufferData(GL_COPY_READ_BUFFER, segmentSize * SEGMENTS, nullptr, GL_STREAM_DRAW);
+        }
+    }
+
+    void destroy()
+    {
+        for (GLsync &fence : fences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+        if (mapped)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, staging);
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+            mapped = nullptr;
+        }
+        glDeleteBuffers(1, &staging);
+        staging = 0;
+    }
+
+    // Copies size bytes into dst at dstOffset, ordered before the next draw
+    void upload(GLuint dst, GLintptr dstOffset, const void *data, GLsizeiptr size)
+    {
+        if (size <= 0)
+            return;
+        if (used + size > segmentSize)
+        {
+            // Out of room: start over with a bigger ring. GL keeps the old
+            // storage alive until the copies already issued from it are done.
+            GLsizeiptr bytes = std::max(segmentSize * 2, used + size);
+            destroy();
+            init(bytes);
+            segment = 0;
+            used = 0;
+            segmentReady = true;
+        }
+        if (!segmentReady)
+        {
+            // Written three frames ago, so normally long signalled
+            if (fences[segment])
+            {
+                while (glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+                    ;
+                glDeleteSync(fences[segment]);
+                fences[segment] = nullptr;
             }
+            segmentReady = true;
+        }
+
+        GLintptr offset = segment * segmentSize + used;
+        glBindBuffer(GL_COPY_READ_BUFFER, staging);
+        if (mapped)
+        {
+            memcpy(mapped + offset, data, size);
+        }
+        else
+        {
+            // The fence already guarantees the range is free
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+            void *ptr = glMapBufferRange(GL_COPY_READ_BUFFER, offset, size, flags);
+            memcpy(ptr, data, size);
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, dst);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, offset, dstOffset, size);
+
+        used += (size + 15) & ~GLsizeiptr(15);
+    }
+
+    // Fences the segment written this frame and moves on to the next one
+    void endFrame()
+    {
+        if (!segmentReady)
+            return;
+        fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        segment = (segment + 1) % SEGMENTS;
+        used = 0;
+        segmentReady = false;
+    }
+};
+
+StreamUploader streamUploader;
+GLsizeiptr paletteSize = 0; // Allocated size of paletteBuffer
+
+// Uploads the whole palette. Storage is only re-specified when the size
+// changes (a new net); otherwise the data goes through the streaming ring.
+void upload_whole_palette()
+{
+    GLsizeiptr bytes = palette.size() * sizeof(glm::mat4);
+    if (bytes != paletteSize)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, paletteBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, bytes, palette.data(), GL_DYNAMIC_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, paletteTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, paletteBuffer);
+        paletteSize = bytes;
+        return;
+    }
+    streamUploader.upload(paletteBuffer, 0, palette.data(), bytes);
+}
+
+// Uploads whatever changed since the last frame; idle frames upload nothing
+void display_polygons()
+{
+    if (netUploadPending)
+    {
+        // Static until the next net; element buffers are bound through their VAOs
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, buffer.size() * sizeof(NetVertex), buffer.data(), GL_STATIC_DRAW);
+        glBindVertexArray(VAO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, edgeIndices.size() * sizeof(uint32_t), edgeIndices.data(), GL_STATIC_DRAW);
+        glBindVertexArray(faceVAO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, faceIndices.size() * sizeof(uint32_t), faceIndices.data(), GL_STATIC_DRAW);
+        glBindVertexArray(0);
+        netUploadPending = false;
+        wireUploadPending = true;
+    }
+    if (wireframeMode && wireUploadPending)
+    {
+        build_wire_buffer();
+        glBindBuffer(GL_ARRAY_BUFFER, wireVBO);
+        glBufferData(GL_ARRAY_BUFFER, wireBuffer.size() * sizeof(WireVertex), wireBuffer.data(), GL_STATIC_DRAW);
+        wireUploadPending = false;
+    }
+    if (fullUploadPending)
+    {
+        upload_whole_palette();
+
+        fullUploadPending = false;
+        changedPolys.clear();
+        return;
+    }
+    if (changedPolys.empty())
+        return;
+
+    // Each run of consecutive changed ids becomes a single upload
+    std::sort(changedPolys.begin(), changedPolys.end());
+    changedPolys.erase(std::unique(changedPolys.begin(), changedPolys.end()), changedPolys.end());
+    for (size_t first = 0, last; first < changedPolys.size(); first = last + 1)
+    {
+        last = first;
+        while (last + 1 < changedPolys.size() && changedPolys[last + 1] == changedPolys[last] + 1)
+            ++last;
+        PolyId begin = changedPolys[first];
+        PolyId end = changedPolys[last] + 1;
+        streamUploader.upload(paletteBuffer, begin * sizeof(glm::mat4), palette.data() + begin,
+                              (end - begin) * sizeof(glm::mat4));
+    }
+    changedPolys.clear();
+}
+
+// Phases of a frame. Each is timed on the CPU; the draw passes are also
+// timed on the GPU.
+enum FramePhase
+{
+    PHASE_INPUT,
+    PHASE_FOLD,
+    PHASE_BUILD,
+    PHASE_UPLOAD,
+    PHASE_GRID,
+    PHASE_FACES,
+    PHASE_EDGES,
+    PHASE_SOFT,  // CPU rasterizer, in place of the GPU passes
+    PHASE_RAY,   // CPU ray tracer, likewise
+    PHASE_CAPTURE,
+    PHASE_FRAME, // The whole frame, without time spent asleep
+    PHASE_COUNT
+};
+
+const char *phaseNames[PHASE_COUNT] = {"input", "fold", "build_buffer", "upload", "grid", "faces", "edges", "soft_raster", "ray_trace", "capture", "frame"};
+const int GPU_FIRST = PHASE_GRID, GPU_PASSES = PHASE_EDGES - PHASE_GRID + 1;
+
+// Rolling per-phase timings over the last HISTORY frames. GPU passes use
+// GL_TIME_ELAPSED queries from a ring of QUERY_FRAMES sets, read only once
+// GL_QUERY_RESULT_AVAILABLE says so, so profiling never stalls the
+// pipeline. A result still pending when its set comes round again is dropped.
+struct FrameProfiler
+{
+    static const int HISTORY = 600;
+    static const int QUERY_FRAMES = 3;
+
+    struct Series
+    {
+        float ms[HISTORY];
+        int count = 0, next = 0;
+
+        void add(float value)
+        {
+            ms[next] = value;
+            next = (next + 1) % HISTORY;
+            count = std::min(count + 1, HISTORY);
         }
+
+        void stats(float &lo, float &avg, float &p99) const
+        {
+            std::vector<float> sorted(ms, ms + count);
+            std::sort(sorted.begin(), sorted.end());
+            lo = sorted.front();
+            avg = 0.0f;
+            for (float value : sorted)
+                avg += value;
+            avg /= count;
+            p99 = sorted[std::max(0, (count * 99 + 99) / 100 - 1)];
+        }
+    };
+
+    Series cpu[PHASE_COUNT];
+    Series gpu[GPU_PASSES];
+    GLuint queries[QUERY_FRAMES][GPU_PASSES] = {};
+    bool pending[QUERY_FRAMES][GPU_PASSES] = {};
+    int querySet = 0;
+    std::chrono::steady_clock::time_point started[PHASE_COUNT];
+
+    void init()
+    {
+        glGenQueries(QUERY_FRAMES * GPU_PASSES, &queries[0][0]);
+    }
+
+    void destroy()
+    {
+        glDeleteQueries(QUERY_FRAMES * GPU_PASSES, &queries[0][0]);
+    }
+
+    void begin(FramePhase phase)
+    {
+        started[phase] = std::chrono::steady_clock::now();
+        int pass = phase - GPU_FIRST;
+        if (pass >= 0 && pass < GPU_PASSES)
+        {
+            pending[querySet][pass] = false;
+            glBeginQuery(GL_TIME_ELAPSED, queries[querySet][pass]);
+        }
+    }
+
+    void end(FramePhase phase)
+    {
+        int pass = phase - GPU_FIRST;
+        if (pass >= 0 && pass < GPU_PASSES)
+        {
+            glEndQuery(GL_TIME_ELAPSED);
+            pending[querySet][pass] = true;
+        }
+        std::chrono::duration<float, std::milli> elapsed = std::chrono::steady_clock::now() - started[phase];
+        cpu[phase].add(elapsed.count());
+    }
+
+    // Collects every GPU result that is ready and moves to the next query set
+    void endFrame()
+    {
+        for (int set = 0; set < QUERY_FRAMES; ++set)
+            for (int pass = 0; pass < GPU_PASSES; ++pass)
+            {
+                if (!pending[set][pass])
+                    continue;
+                GLuint available = 0;
+                glGetQueryObjectuiv(queries[set][pass], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    continue;
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(queries[set][pass], GL_QUERY_RESULT, &ns);
+                gpu[pass].add(ns * 1e-6f);
+                pending[set][pass] = false;
+            }
+        querySet = (querySet + 1) % QUERY_FRAMES;
+    }
+
+    // One row per timed series: phase, source, samples, min, avg, p99 (ms)
+    bool writeCsv(const std::string &path) const
+    {
+        std::ofstream out(path);
+        if (!out)
+        {
+            std::cout << "ERROR::PROFILER::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+        out << "phase,source,samples,min_ms,avg_ms,p99_ms\n";
+        for (int source = 0; source < 2; ++source)
+            for (int phase = 0; phase < PHASE_COUNT; ++phase)
+            {
+                int pass = phase - GPU_FIRST;
+                if (source == 1 && (pass < 0 || pass >= GPU_PASSES))
+                    continue;
+                const Series &series = source == 0 ? cpu[phase] : gpu[pass];
+                if (series.count == 0)
+                    continue;
+                float lo, avg, p99;
+                series.stats(lo, avg, p99);
+                out << phaseNames[phase] << (source == 0 ? ",cpu," : ",gpu,") << series.count << ","
+                    << lo << "," << avg << "," << p99 << "\n";
+            }
+        std::cout << "Wrote frame profile to " << path << std::endl;
+        return true;
+    }
+};
+
+FrameProfiler frameProfiler;
+std::string profileCsvPath; // --profile-csv: written when the viewer exits
+
+// True only on the frame the key goes down
+bool keyPressedOnce(GLFWwindow *window, int key)
+{
+    static bool wasDown[GLFW_KEY_LAST + 1] = {};
+    bool down = glfwGetKey(window, key) == GLFW_PRESS;
+    bool pressed = down && !wasDown[key];
+    wasDown[key] = down;
+    return pressed;
+}
+
+// True while a key that moves something every frame is held down
+bool continuousInputHeld(GLFWwindow *window)
+{
+    static const int keys[] = {GLFW_KEY_UP, GLFW_KEY_DOWN, GLFW_KEY_LEFT, GLFW_KEY_RIGHT, GLFW_KEY_W, GLFW_KEY_S};
+    for (int key : keys)
+        if (glfwGetKey(window, key) == GLFW_PRESS)
+            return true;
+    return false;
+}
+
+// Whether the next frame can differ from the one on screen. If not, the
+// render loop sleeps until an event arrives.
+bool frameNeeded(GLFWwindow *window)
+{
+    return sceneDirty || buffersDirty || !animatingHinges.empty() || foldScheduler.playing ||
+           (rayTrace && rayRefining) || captureFrames || continuousInputHeld(window);
+}
+
+// Events that change what is on screen without going through processInput
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+    sceneDirty = true;
+}
+
+void window_refresh_callback(GLFWwindow *window)
+{
+    sceneDirty = true;
+}
+
+void framebuffer_size_callback(GLFWwindow *window, int width, int height)
+{
+    sceneDirty = true;
+}
+
+// Handle keyboard input for camera movement
+void processInput(GLFWwindow *window)
+{
+    if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+        glfwSetWindowShouldClose(window, true);
+    if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
+    {
+        switch (whatIsMoving)
+        {
+        case CAM:
+            camY += camSpeed;
+            break;
+        case CENTER:
+            centerY += centerSpeed;
+            break;
+        case VERTICES:
+            netOffset.y += vertexSpeed;
+        }
+    }
+    if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
+    {
+        switch (whatIsMoving)
+        {
+        case CAM:
+            camY -= camSpeed;
+            break;
+        case CENTER:
+            centerY -= centerSpeed;
+            break;
+        case VERTICES:
+            netOffset.y -= vertexSpeed;
+        }
+    }
+    if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+    {
+        switch (whatIsMoving)
+        {
+        case CAM:
+            camX -= camSpeed;
+            break;
+        case CENTER:
+            centerX -= centerSpeed;
+            break;
+        case VERTICES:
+            netOffset.x -= vertexSpeed;
+        }
+    }
+    if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+    {
+        switch (whatIsMoving)
+        {
+        case CAM:
+            camX += camSpeed;
+            break;
+        case CENTER:
+            centerX += centerSpeed;
+            break;
+        case VERTICES:
+            netOffset.x += vertexSpeed;
+        }
+    }
+    if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    {
+
+        switch (whatIsMoving)
+        {
+        case CAM:
+            camZ -= camSpeed;
+            break;
+        case CENTER:
+            centerZ -= centerSpeed;
+            break;
+        case VERTICES:
+            netOffset.z -= vertexSpeed;
+        }
+    }
+    if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    {
+        switch (whatIsMoving)
+        {
+        case CAM:
+            camZ += camSpeed;
+            break;
+        case CENTER:
+            centerZ += centerSpeed;
+            break;
+        case VERTICES:
+            netOffset.z += vertexSpeed;
+        }
+    }
+    if (glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS)
+    {
+        if (whatIsMoving == CAM)
+            whatIsMoving = CENTER;
+        else if (whatIsMoving == CENTER)
+            whatIsMoving = CAM;
+        else if (whatIsMoving == VERTICES)
+            whatIsMoving = CAM;
+    }
+    if (glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS)
+    {
+        if (whatIsMoving != VERTICES)
+            whatIsMoving = VERTICES;
+        else
+            whatIsMoving = CAM;
+    }
+    if (glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS)
+    {
+        if (whatIsMoving == CAM)
+        {
+            camX = 0.0f;
+            camY = 0.0f;
+            camZ = 20.0f;
+        }
+        else if (whatIsMoving == CENTER)
+        {
+            centerX = 0.0f;
+            centerY = 0.0f;
+            centerZ = 0.0f;
+        }
+    }
+    static bool spaceWasPressed = false;
+    if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
+        spaceWasPressed = false;
+    bool spacePressed = glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS;
+
+    if (spacePressed && !spaceWasPressed)
+    {
+        foldScheduler.execute(FOLD_NEXT);
+        spaceWasPressed = true;
+    }
+    if (keyPressedOnce(window, GLFW_KEY_F))
+        foldScheduler.execute(FOLD_ALL);
+    if (keyPressedOnce(window, GLFW_KEY_U))
+        foldScheduler.execute(UNFOLD_LAST);
+    if (keyPressedOnce(window, GLFW_KEY_X))
+        foldScheduler.execute(FOLD_RESET);
+    if (keyPressedOnce(window, GLFW_KEY_A))
+        animateFolds = !animateFolds;
+    if (keyPressedOnce(window, GLFW_KEY_B))
+        wireframeMode = !wireframeMode;
+    if (keyPressedOnce(window, GLFW_KEY_G))
+        proceduralGrid = !proceduralGrid;
+    if (keyPressedOnce(window, GLFW_KEY_O))
+        orderIndependent = !orderIndependent;
+    if (keyPressedOnce(window, GLFW_KEY_C))
+        softwareRender = !softwareRender;
+    if (keyPressedOnce(window, GLFW_KEY_Y))
+        rayTrace = !rayTrace;
+    if (keyPressedOnce(window, GLFW_KEY_K))
+        captureFrames = !captureFrames;
+    if (keyPressedOnce(window, GLFW_KEY_P))
+        frameProfiler.writeCsv(profileCsvPath.empty() ? "frame_profile.csv" : profileCsvPath);
+}
+// Detect click within UI menu area
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
+{
+    sceneDirty = true;
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+    {
+        double xpos, ypos;
+        glfwGetCursorPos(window, &xpos, &ypos);
+        if (xpos < 100)
+        {
+            int boxIndex = static_cast<int>(ypos / 60);
+            if (boxIndex >= 0 && boxIndex < 7)
+            {
+                std::cout << "Clicked on solid box: " << boxIndex << std::endl;
+                switch (boxIndex)
+                {
+                case 0:
+                    build_tetrahedron_net();
+                    break;
+                case 1:
+                    build_hexahedron_net();
+                    break;
+                case 2:
+                    build_octahedron_net();
+                    break;
+                case 3:
+                    build_dodecahedron_net();
+                    break;
+                case 4:
+                    build_icosahedron_net();
+                    break;
+                case 5:
+                    build_cuboctahedron_net();
+                    break;
+                case 6:
+                    build_truncated_icosahedron_net();
+                    break;
+                }
+            }
+        }
+    }
+}
+
+const char *gridVertexShaderSource = R"(
+    #version 330 core
+    layout (location = 0) in vec3 aPos;
+    layout (std140) uniform Camera {
+        mat4 projection;
+        mat4 view;
+    };
+    void main() {
+        gl_Position = projection * view * vec4(aPos, 1.0);
+    })";
+
+const char *gridFragmentShaderSource = R"(
+    #version 330 core
+    out vec4 FragColor;
+    void main() {
+        FragColor = vec4(0.5, 0.5, 0.5, 0.2); // Semi-transparent gray
+    })";
+
+// Infinite grid: a full-screen quad per plane. Each pixel's view ray is
+// intersected with the plane and unit lines are found analytically, so the
+// cost does not depend on extent or density.
+const char *proceduralGridVertexShaderSource = R"(
+    #version 330 core
+    layout (std140) uniform Camera {
+        mat4 projection;
+        mat4 view;
+    };
+    out vec3 vNear;
+    out vec3 vFar;
+    const vec2 corners[4] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0), vec2(1.0, 1.0));
+    vec3 unproject(vec2 p, float z) {
+        vec4 v = inverse(projection * view) * vec4(p, z, 1.0);
+        return v.xyz / v.w;
+    }
+    void main() {
+        vec2 p = corners[gl_VertexID];
+        vNear = unproject(p, -1.0);
+        vFar = unproject(p, 1.0);
+        gl_Position = vec4(p, 0.0, 1.0);
+    })";
+
+const char *proceduralGridFragmentShaderSource = R"(
+    #version 330 core
+    layout (std140) uniform Camera {
+        mat4 projection;
+        mat4 view;
+    };
+    uniform int plane; // Axis normal to the grid: 0 = YZ, 1 = XZ, 2 = XY
+    in vec3 vNear;
+    in vec3 vFar;
+    out vec4 FragColor;
+    void main() {
+        vec3 ray = vFar - vNear;
+        float t = -vNear[plane] / ray[plane];
+        if (!(t > 0.0 && t < 1.0))
+            discard;
+        vec3 hit = vNear + t * ray;
+        vec2 uv = plane == 0 ? hit.yz : plane == 1 ? hit.xz : hit.xy;
+
+        // Distance to the nearest unit line in pixels, one pixel wide
+        vec2 d = abs(fract(uv - 0.5) - 0.5) / fwidth(uv);
+        float line = 1.0 - min(min(d.x, d.y), 1.0);
+        float fade = 1.0 - smoothstep(20.0, 60.0, length(hit - vNear));
+        float alpha = 0.2 * line * fade;
+        if (alpha <= 0.0)
+            discard;
+
+        // Depth of the plane, so the net hides it as real geometry would
+        vec4 clip = projection * view * vec4(hit, 1.0);
+        gl_FragDepth = 0.5 * clip.z / clip.w + 0.5;
+        FragColor = vec4(0.5, 0.5, 0.5, alpha);
+    })";
+
+// Grid data
+unsigned int gridVAO = 0, gridVBO = 0;
+std::vector<float> gridVertices;
+
+// Line list of the three axis-plane grids, shared by the GL and CPU renderers
+void build_grid_vertices(int size, int divisions)
+{
+    gridVertices.clear();
+    float step = (float)size / divisions;
+    float halfSize = size * 0.5f;
+
+    // Create grid lines of XZ plane
+    for (int i = 0; i <= divisions; ++i)
+    {
+        float pos = -halfSize + i * step;
+
+        // X-axis lines (vertical in XZ plane)
+        gridVertices.push_back(pos);
+        gridVertices.push_back(0.0f);
+        gridVertices.push_back(-halfSize);
+
+        gridVertices.push_back(pos);
+        gridVertices.push_back(0.0f);
+        gridVertices.push_back(halfSize);
+
+        // Z-axis lines (horizontal in XZ plane)
+        gridVertices.push_back(-halfSize);
+        gridVertices.push_back(0.0f);
+        gridVertices.push_back(pos);
+
+        gridVertices.push_back(halfSize);
+        gridVertices.push_back(0.0f);
+        gridVertices.push_back(pos);
+    }
+
+    // Create grid lines of YZ plane
+    for (int i = 0; i <= divisions; ++i)
+    {
+        float pos = -halfSize + i * step;
+
+        // Y-axis lines (vertical in YZ plane)
+        gridVertices.push_back(0.0f);
+        gridVertices.push_back(pos);
+        gridVertices.push_back(halfSize);
+
+        gridVertices.push_back(0.0f);
+        gridVertices.push_back(pos);
+        gridVertices.push_back(-halfSize);
+
+        // Z-axis lines (horizontal in YZ plane)
+        gridVertices.push_back(0.0f);
+        gridVertices.push_back(halfSize);
+        gridVertices.push_back(pos);
+
+        gridVertices.push_back(0.0f);
+        gridVertices.push_back(-halfSize);
+        gridVertices.push_back(pos);
+    }
+
+    // Create grid lines of XY plane
+    for (int i = 0; i <= divisions; ++i)
+    {
+        float pos = -halfSize + i * step;
+
+        // X-axis lines (vertical in XY plane)
+        gridVertices.push_back(pos);
+        gridVertices.push_back(-halfSize);
+        gridVertices.push_back(0.0f);
+
+        gridVertices.push_back(pos);
+        gridVertices.push_back(halfSize);
+        gridVertices.push_back(0.0f);
+
+        // Y-axis lines (horizontal in XY plane)
+        gridVertices.push_back(halfSize);
+        gridVertices.push_back(pos);
+        gridVertices.push_back(0.0f);
+
+        gridVertices.push_back(-halfSize);
+        gridVertices.push_back(pos);
+        gridVertices.push_back(0.0f);
+    }
+}
+
+void createGrid(int size, int divisions)
+{
+    // Replaces any grid built before
+    if (gridVAO)
+    {
+        glDeleteVertexArrays(1, &gridVAO);
+        glDeleteBuffers(1, &gridVBO);
+    }
+    build_grid_vertices(size, divisions);
+
+    // Setup grid VAO/VBO
+    glGenVertexArrays(1, &gridVAO);
+    glGenBuffers(1, &gridVBO);
+    glBindVertexArray(gridVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
+    glBufferData(GL_ARRAY_BUFFER, gridVertices.size() * sizeof(float), gridVertices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
+    glEnableVertexAttribArray(0);
+}
+
+// Translucent faces for weighted blended OIT. Colour, premultiplied and
+// weighted by view distance, adds into the first target while the alpha
+// channel multiplies down to the revealage; the weights add into the second.
+const char *oitFragmentShaderSource = R"(
+#version 330 core
+layout (std140) uniform Camera {
+    mat4 projection;
+    mat4 view;
+};
+layout (location = 0) out vec4 accum;
+layout (location = 1) out float weight;
+void main() {
+    vec4 color = vec4(0.8, 0.8, 0.8, 0.3); // Same gray as the face shader
+    float ndc = 2.0 * gl_FragCoord.z - 1.0;
+    float distance = projection[3][2] / (ndc + projection[2][2]);
+    float w = color.a * clamp(10.0 / (1e-5 + pow(distance / 5.0, 2.0) + pow(distance / 200.0, 6.0)), 1e-2, 3e3);
+    accum = vec4(color.rgb * color.a * w, color.a);
+    weight = color.a * w;
+})";
+
+// Resolves the OIT targets over the opaque scene with a full-screen quad
+const char *compositeVertexShaderSource = R"(
+#version 330 core
+const vec2 corners[4] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0), vec2(1.0, 1.0));
+void main() {
+    gl_Position = vec4(corners[gl_VertexID], 0.0, 1.0);
+})";
+
+const char *compositeFragmentShaderSource = R"(
+#version 330 core
+uniform sampler2D accumTexture;
+uniform sampler2D weightTexture;
+out vec4 FragColor;
+void main() {
+    ivec2 p = ivec2(gl_FragCoord.xy);
+    vec4 accum = texelFetch(accumTexture, p, 0);
+    float revealage = accum.a;
+    if (revealage >= 1.0)
+        discard;
+    float weight = texelFetch(weightTexture, p, 0).r;
+    FragColor = vec4(accum.rgb / max(weight, 1e-5), 1.0 - revealage);
+})";
+
+// Texture units the composite pass reads from; unit 0 holds the palette
+const GLint ACCUM_UNIT = 1, WEIGHT_UNIT = 2;
+const GLint SOFT_UNIT = 3; // CPU-rendered frames on their way to the window
+
+// Offscreen targets for weighted blended order-independent transparency.
+// The scene is drawn into sceneFBO; translucent faces then go to oitFBO,
+// which shares its depth buffer, so they are tested against the opaque
+// geometry without sorting. composite() resolves them over the scene and
+// present() copies the result to the window.
+struct TransparencyTargets
+{
+    GLuint sceneFBO = 0, sceneColor = 0, depth = 0;
+    GLuint oitFBO = 0, accum = 0, weight = 0;
+    int width = 0, height = 0;
+
+    // (Re)allocates every target when the framebuffer size changes
+    void resize(int w, int h)
+    {
+        if (w == width && h == height)
+            return;
+        destroy();
+        width = w;
+        height = h;
+
+        glGenRenderbuffers(1, &sceneColor);
+        glBindRenderbuffer(GL_RENDERBUFFER, sceneColor);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, w, h);
+        glGenRenderbuffers(1, &depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, w, h);
+
+        glGenFramebuffers(1, &sceneFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, sceneColor);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER::SCENE_INCOMPLETE" << std::endl;
+
+        accum = createTarget(GL_RGBA16F, GL_RGBA, ACCUM_UNIT);
+        weight = createTarget(GL_R16F, GL_RED, WEIGHT_UNIT);
+        glActiveTexture(GL_TEXTURE0);
+
+        glGenFramebuffers(1, &oitFBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, oitFBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accum, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, weight, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        GLenum buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, buffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER::OIT_INCOMPLETE" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // A float colour target, left bound on its texture unit for the composite
+    GLuint createTarget(GLint internalFormat, GLenum format, GLint unit)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return texture;
+    }
+
+    void beginScene()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+    }
+
+    // Colour adds up, revealage multiplies down; depth is tested, not written
+    void beginTransparent()
+    {
+        static const float clearAccum[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+        static const float clearWeight[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        glBindFramebuffer(GL_FRAMEBUFFER, oitFBO);
+        glClearBufferfv(GL_COLOR, 0, clearAccum);
+        glClearBufferfv(GL_COLOR, 1, clearWeight);
+        glDepthMask(GL_FALSE);
+        glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    void composite(GLuint program, GLuint fullScreenVAO)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFBO);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDisable(GL_DEPTH_TEST);
+        glUseProgram(program);
+        glBindVertexArray(fullScreenVAO);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        glEnable(GL_DEPTH_TEST);
+        glDepthMask(GL_TRUE);
+    }
+
+    void present()
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, sceneFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void destroy()
+    {
+        glDeleteFramebuffers(1, &sceneFBO);
+        glDeleteFramebuffers(1, &oitFBO);
+        glDeleteRenderbuffers(1, &sceneColor);
+        glDeleteRenderbuffers(1, &depth);
+        glDeleteTextures(1, &accum);
+        glDeleteTextures(1, &weight);
+        sceneFBO = oitFBO = sceneColor = depth = accum = weight = 0;
+        width = height = 0;
+    }
+};
+
+TransparencyTargets transparencyTargets;
+
+// Helper functions for shader error checking
+void checkShaderCompile(unsigned int shader, const std::string &type)
+{
+    GLint success;
+    GLchar infoLog[1024];
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(shader, 1024, NULL, infoLog);
+        std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n"
+                  << infoLog << std::endl;
+    }
+}
+
+void checkProgramLink(unsigned int program, const std::string &type)
+{
+    GLint success;
+    GLchar infoLog[1024];
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(program, 1024, NULL, infoLog);
+        std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n"
+                  << infoLog << std::endl;
+    }
+}
+
+// Binding point of the Camera uniform block shared by every program
+const GLuint CAMERA_BINDING = 0;
+
+// Builds every shader program. Each distinct source is compiled once and
+// shared, and uniform locations are looked up once at link time, so the
+// render loop never queries GL by name.
+struct ShaderRegistry
+{
+    // Compiled shaders, keyed by type and source text
+    std::unordered_map<std::string, GLuint> shaders;
+    // Active uniform locations of every linked program
+    std::unordered_map<GLuint, std::unordered_map<std::string, GLint>> uniforms;
+
+    GLuint shader(GLenum type, const char *source, const std::string &name)
+    {
+        std::string key = std::to_string(type) + source;
+        auto found = shaders.find(key);
+        if (found != shaders.end())
+            return found->second;
+
+        GLuint id = glCreateShader(type);
+        glShaderSource(id, 1, &source, NULL);
+        glCompileShader(id);
+        checkShaderCompile(id, name);
+        shaders.emplace(key, id);
+        return id;
+    }
+
+    GLuint program(const char *vertexSource, const char *fragmentSource, const std::string &name)
+    {
+        GLuint id = glCreateProgram();
+        glAttachShader(id, shader(GL_VERTEX_SHADER, vertexSource, name + " Vertex"));
+        glAttachShader(id, shader(GL_FRAGMENT_SHADER, fragmentSource, name + " Fragment"));
+        glLinkProgram(id);
+        checkProgramLink(id, name);
+
+        GLuint camera = glGetUniformBlockIndex(id, "Camera");
+        if (camera != GL_INVALID_INDEX)
+            glUniformBlockBinding(id, camera, CAMERA_BINDING);
+
+        // Uniforms inside blocks have no location and are skipped
+        std::unordered_map<std::string, GLint> &locations = uniforms[id];
+        GLint count = 0;
+        glGetProgramiv(id, GL_ACTIVE_UNIFORMS, &count);
+        for (GLint i = 0; i < count; ++i)
+        {
+            GLchar uniformName[256];
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(id, i, sizeof(uniformName), NULL, &size, &type, uniformName);
+            GLint location = glGetUniformLocation(id, uniformName);
+            if (location >= 0)
+                locations[uniformName] = location;
+        }
+        return id;
+    }
+
+    // Cached location of a uniform, or -1 (ignored by glUniform*) if inactive
+    GLint uniform(GLuint program, const std::string &name) const
+    {
+        auto found = uniforms.at(program).find(name);
+        return found == uniforms.at(program).end() ? -1 : found->second;
+    }
+
+    void destroy()
+    {
+        for (auto &entry : uniforms)
+            glDeleteProgram(entry.first);
+        for (auto &entry : shaders)
+            glDeleteShader(entry.second);
+        uniforms.clear();
+        shaders.clear();
+    }
+};
+
+ShaderRegistry shaderRegistry;
+
+void camera_matrices(int width, int height, glm::mat4 &projection, glm::mat4 &view)
+{
+    float aspect = height > 0 ? (float)width / (float)height : (float)SCR_WIDTH / (float)SCR_HEIGHT;
+    projection = glm::perspective(glm::radians(45.0f), aspect, 0.1f, 100.0f);
+    view = glm::lookAt(
+        glm::vec3(camX, camY, camZ),
+        glm::vec3(centerX, centerY, centerZ),
+        glm::vec3(0.0f, 1.0f, 0.0f)
+    );
+}
+
+// CPU rendering, for machines without a GPU. Reads the same buffers, palette
+// and mode flags as the GL passes and needs no GL context.
+ThreadPool threadPool;
+SoftRasterizer softRasterizer;
+SoftScene softScene;
+RayTracer rayTracer;
+const int RAY_MAX_SAMPLES = 256; // The window stops refining here
+
+// World-space copy of the current frame for the CPU renderers
+void fill_soft_scene(int width, int height)
+{
+    softScene.width = width;
+    softScene.height = height;
+    camera_matrices(width, height, softScene.projection, softScene.view);
+    glm::mat4 model = glm::translate(glm::mat4(1.0f), netOffset);
+    softScene.vertices.resize(buffer.size());
+    for (size_t i = 0; i < buffer.size(); ++i)
+        softScene.vertices[i] = glm::vec3(model * palette[buffer[i].poly] * glm::vec4(buffer[i].position, 1.0f));
+    softScene.faceIndices = &faceIndices;
+    softScene.edgeIndices = &edgeIndices;
+    softScene.gridVertices = &gridVertices;
+    softScene.diagonals.clear();
+    for (PolyId id : polygons)
+        for (uint32_t i = 1, n = getPoly(id).vertexCount; i + 1 < n; ++i)
+            softScene.diagonals.push_back(uint8_t(fan_diagonals(i, n)));
+    softScene.proceduralGrid = proceduralGrid;
+    softScene.wireframe = wireframeMode;
+    softScene.orderIndependent = orderIndependent;
+}
+
+void render_soft(Image &image, int width, int height)
+{
+    threadPool.start();
+    softRasterizer.pool = &threadPool;
+    fill_soft_scene(width, height);
+    softRasterizer.render(softScene, image);
+}
+
+// Ray traces the frame, adding up to passes samples per pixel to the last
+// frame's, to at most maxSamples. Anything that moved (net, camera, size)
+// starts over.
+void render_ray(Image &image, int width, int height, int maxSamples, int passes)
+{
+    threadPool.start();
+    rayTracer.pool = &threadPool;
+    fill_soft_scene(width, height);
+    if (!rayTracer.sameScene(softScene))
+        rayTracer.begin(softScene);
+    for (int pass = 0; pass < passes && rayTracer.samples < maxSamples; ++pass)
+        rayTracer.refine();
+    rayTracer.resolve(image);
+    rayRefining = rayTracer.samples < maxSamples;
+}
+
+// Every GL object the frame draws with, set up once per context. The
+// window loop and the headless renderer share it, so both draw alike.
+struct SceneRenderer
+{
+    unsigned int faceShaderProgram, edgeShaderProgram, wireShaderProgram;
+    unsigned int gridShaderProgram, proceduralGridProgram, oitShaderProgram, compositeProgram;
+    GLint faceModel, edgeModel, wireModel, oitModel, gridPlane;
+    unsigned int cameraUBO, fullScreenVAO;
+    unsigned int softTexture = 0, softFBO = 0; // Shows CPU-rendered frames
+    int softWidth = 0, softHeight = 0;
+    Image softImage;
+
+    void init()
+    {
+        // Compile shaders; the face and edge programs share one vertex shader
+        faceShaderProgram = shaderRegistry.program(vertexShaderSource, fragmentShaderSource, "Face");
+        edgeShaderProgram = shaderRegistry.program(edgeVertexShaderSource, edgeFragmentShaderSource, "Edge");
+        faceModel = shaderRegistry.uniform(faceShaderProgram, "model");
+        edgeModel = shaderRegistry.uniform(edgeShaderProgram, "model");
+        glUseProgram(faceShaderProgram);
+        glUniform1i(shaderRegistry.uniform(faceShaderProgram, "palette"), 0);
+        glUseProgram(edgeShaderProgram);
+        glUniform1i(shaderRegistry.uniform(edgeShaderProgram, "palette"), 0);
+        wireShaderProgram = shaderRegistry.program(wireVertexShaderSource, wireFragmentShaderSource, "Wire");
+        wireModel = shaderRegistry.uniform(wireShaderProgram, "model");
+        glUseProgram(wireShaderProgram);
+        glUniform1i(shaderRegistry.uniform(wireShaderProgram, "palette"), 0);
+
+        // Camera matrices, written once per frame and read by every program
+        glGenBuffers(1, &cameraUBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
+        glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BINDING, cameraUBO);
+
+        // Persistent mapping for streamed uploads, where the driver offers it
+        if (glfwExtensionSupported("GL_ARB_buffer_storage"))
+            glBufferStorageARB = (PFNGLBUFFERSTORAGEARBPROC)glfwGetProcAddress("glBufferStorage");
+        streamUploader.init(1 << 20);
+        frameProfiler.init();
+
+        // Generate buffers
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &edgeEBO);
+        glGenVertexArrays(1, &faceVAO);
+        glGenBuffers(1, &faceEBO);
+
+        // Polygon transforms, read by both net shaders from texture unit 0
+        glGenBuffers(1, &paletteBuffer);
+        glGenTextures(1, &paletteTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_BUFFER, paletteTexture);
+
+        // Set up edge VAO
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, edgeEBO);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(NetVertex), (void *)offsetof(NetVertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(NetVertex), (void *)offsetof(NetVertex, poly));
+        glEnableVertexAttribArray(1);
+
+        // Set up face VAO, sharing the welded vertices
+        glBindVertexArray(faceVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, faceEBO);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(NetVertex), (void *)offsetof(NetVertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(NetVertex), (void *)offsetof(NetVertex, poly));
+        glEnableVertexAttribArray(1);
+
+        // Set up wireframe VAO
+        glGenVertexArrays(1, &wireVAO);
+        glGenBuffers(1, &wireVBO);
+        glBindVertexArray(wireVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, wireVBO);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(WireVertex), (void *)offsetof(WireVertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT, sizeof(WireVertex), (void *)offsetof(WireVertex, poly));
+        glEnableVertexAttribArray(1);
+        glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(WireVertex), (void *)offsetof(WireVertex, corner));
+        glEnableVertexAttribArray(2);
+
+        // Create grid shader program
+        gridShaderProgram = shaderRegistry.program(gridVertexShaderSource, gridFragmentShaderSource, "Grid");
+
+        createGrid(20, 20);
+
+        // Full-screen passes have no vertex data, but core profile draws need a VAO
+        proceduralGridProgram = shaderRegistry.program(proceduralGridVertexShaderSource,
+                                                       proceduralGridFragmentShaderSource, "Procedural Grid");
+        gridPlane = shaderRegistry.uniform(proceduralGridProgram, "plane");
+        glGenVertexArrays(1, &fullScreenVAO);
+
+        // Order-independent transparency passes
+        oitShaderProgram = shaderRegistry.program(vertexShaderSource, oitFragmentShaderSource, "OIT Face");
+        oitModel = shaderRegistry.uniform(oitShaderProgram, "model");
+        glUseProgram(oitShaderProgram);
+        glUniform1i(shaderRegistry.uniform(oitShaderProgram, "palette"), 0);
+        compositeProgram = shaderRegistry.program(compositeVertexShaderSource,
+                                                  compositeFragmentShaderSource, "OIT Composite");
+        glUseProgram(compositeProgram);
+        glUniform1i(shaderRegistry.uniform(compositeProgram, "accumTexture"), ACCUM_UNIT);
+        glUniform1i(shaderRegistry.uniform(compositeProgram, "weightTexture"), WEIGHT_UNIT);
+
+        // Enable blending and depth testing
+        glEnable(GL_DEPTH_TEST);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    // Draws one frame of the current net at width x height. Offscreen frames
+    // land in transparencyTargets.sceneFBO; OIT always draws offscreen.
+    void draw(int width, int height, bool offscreen)
+    {
+        if (offscreen)
+        {
+            transparencyTargets.resize(width, height);
+            transparencyTargets.beginScene();
+        }
+        glViewport(0, 0, width, height);
+
+        // Clear buffers
+        glClearColor(0.05f, 0.05f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // Camera setup
+        glm::mat4 projection, view;
+        camera_matrices(width, height, projection, view);
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), netOffset);
+        glm::mat4 camera[2] = {projection, view};
+        glBindBuffer(GL_UNIFORM_BUFFER, cameraUBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(camera), camera);
+
+        frameProfiler.begin(PHASE_UPLOAD);
+        display_polygons();
+        frameProfiler.end(PHASE_UPLOAD);
+
+        // 1. Draw grid first (behind everything)
+        frameProfiler.begin(PHASE_GRID);
+        if (proceduralGrid)
+        {
+            glUseProgram(proceduralGridProgram);
+            glBindVertexArray(fullScreenVAO);
+            for (int plane = 0; plane < 3; ++plane)
+            {
+                glUniform1i(gridPlane, plane);
+                glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+            }
+        }
+        else
+        {
+            glUseProgram(gridShaderProgram);
+            glBindVertexArray(gridVAO);
+            glDrawArrays(GL_LINES, 0, gridVertices.size() / 3);
+        }
+        frameProfiler.end(PHASE_GRID);
+
+        if (wireframeMode)
+        {
+            // 2. Draw faces and their outlines in one pass
+            frameProfiler.begin(PHASE_FACES);
+            glDepthMask(GL_FALSE);
+            glUseProgram(wireShaderProgram);
+            glUniformMatrix4fv(wireModel, 1, GL_FALSE, glm::value_ptr(model));
+            glBindVertexArray(wireVAO);
+            glDrawArrays(GL_TRIANGLES, 0, wireBuffer.size());
+            glDepthMask(GL_TRUE);
+            frameProfiler.end(PHASE_FACES);
+        }
+        else if (orderIndependent)
+        {
+            // 2. Draw edges first, so faces in front of them tint them
+            frameProfiler.begin(PHASE_EDGES);
+            glUseProgram(edgeShaderProgram);
+            glUniformMatrix4fv(edgeModel, 1, GL_FALSE, glm::value_ptr(model));
+            glBindVertexArray(VAO);
+            glDrawElements(GL_LINES, edgeIndices.size(), GL_UNSIGNED_INT, (void *)0);
+            frameProfiler.end(PHASE_EDGES);
+
+            // 3. Accumulate faces in any order, then resolve them over the scene.
+            // Faces are pushed back a little so they never cover their own edges.
+            frameProfiler.begin(PHASE_FACES);
+            transparencyTargets.beginTransparent();
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(1.0f, 1.0f);
+            glUseProgram(oitShaderProgram);
+            glUniformMatrix4fv(oitModel, 1, GL_FALSE, glm::value_ptr(model));
+            glBindVertexArray(faceVAO);
+            glDrawElements(GL_TRIANGLES, faceIndices.size(), GL_UNSIGNED_INT, (void *)0);
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            transparencyTargets.composite(compositeProgram, fullScreenVAO);
+            frameProfiler.end(PHASE_FACES);
+        }
+        else
+        {
+            // 2. Draw faces (with depth test but no writing)
+            frameProfiler.begin(PHASE_FACES);
+            glDepthMask(GL_FALSE);
+            glUseProgram(faceShaderProgram);
+            glUniformMatrix4fv(faceModel, 1, GL_FALSE, glm::value_ptr(model));
+            glBindVertexArray(faceVAO);
+            glDrawElements(GL_TRIANGLES, faceIndices.size(), GL_UNSIGNED_INT, (void *)0);
+            glDepthMask(GL_TRUE);
+            frameProfiler.end(PHASE_FACES);
+
+            // 2. Draw edges (with depth writing)
+            frameProfiler.begin(PHASE_EDGES);
+            glUseProgram(edgeShaderProgram);
+            glUniformMatrix4fv(edgeModel, 1, GL_FALSE, glm::value_ptr(model));
+            glBindVertexArray(VAO);
+            glDrawElements(GL_LINES, edgeIndices.size(), GL_UNSIGNED_INT, (void *)0);
+            frameProfiler.end(PHASE_EDGES);
+        }
+    }
+
+    // Draws the frame on the CPU, ray traced or rasterized, and copies it to
+    // the window. The GL buffers are still kept up to date, ready for
+    // switching back.
+    void drawSoftware(int width, int height, bool rayTraced)
+    {
+        frameProfiler.begin(PHASE_UPLOAD);
+        display_polygons();
+        frameProfiler.end(PHASE_UPLOAD);
+
+        FramePhase phase = rayTraced ? PHASE_RAY : PHASE_SOFT;
+        frameProfiler.begin(phase);
+        if (rayTraced)
+            render_ray(softImage, width, height, RAY_MAX_SAMPLES, 1);
+        else
+            render_soft(softImage, width, height);
+        frameProfiler.end(phase);
+
+        if (!softTexture)
+        {
+            glGenTextures(1, &softTexture);
+            glGenFramebuffers(1, &softFBO);
+        }
+        glActiveTexture(GL_TEXTURE0 + SOFT_UNIT);
+        glBindTexture(GL_TEXTURE_2D, softTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (width != softWidth || height != softHeight)
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, softImage.pixels.data());
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, softFBO);
+            glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, softTexture, 0);
+            softWidth = width;
+            softHeight = height;
+        }
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, softImage.pixels.data());
+        glActiveTexture(GL_TEXTURE0);
+
+        // The image is top row first, so it is flipped on the way
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, softFBO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width, height, 0, height, width, 0, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Reads back an offscreen frame, flipped so the top row comes first
+    void readScene(Image &image)
+    {
+        image.width = transparencyTargets.width;
+        image.height = transparencyTargets.height;
+        size_t stride = size_t(image.width) * 3;
+        std::vector<uint8_t> rows(stride * image.height);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, transparencyTargets.sceneFBO);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, image.width, image.height, GL_RGB, GL_UNSIGNED_BYTE, rows.data());
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        image.pixels.resize(rows.size());
+        for (int y = 0; y < image.height; ++y)
+            std::memcpy(&image.pixels[y * stride], &rows[(image.height - 1 - y) * stride], stride);
     }
-}
 
-const char *gridVertexShaderSource = R"(
-    #version 330 core
-    layout (location = 0) in vec3 aPos;
-    uniform mat4 projection;
-    uniform mat4 view;
-    void main() {
-        gl_Position = projection * view * vec4(aPos, 1.0);
-    })";
+    void destroy()
+    {
+        frameProfiler.destroy();
+        streamUploader.destroy();
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &edgeEBO);
+        glDeleteVertexArrays(1, &faceVAO);
+        glDeleteBuffers(1, &faceEBO);
+        glDeleteVertexArrays(1, &gridVAO);
+        glDeleteBuffers(1, &gridVBO);
+        glDeleteVertexArrays(1, &fullScreenVAO);
+        transparencyTargets.destroy();
+        glDeleteVertexArrays(1, &wireVAO);
+        glDeleteBuffers(1, &wireVBO);
+        glDeleteTextures(1, &paletteTexture);
+        glDeleteBuffers(1, &paletteBuffer);
+        glDeleteBuffers(1, &cameraUBO);
+        glDeleteTextures(1, &softTexture);
+        glDeleteFramebuffers(1, &softFBO);
+        shaderRegistry.destroy();
+    }
+};
 
-const char *gridFragmentShaderSource = R"(
-    #version 330 core
-    out vec4 FragColor;
-    void main() {
-        FragColor = vec4(0.5, 0.5, 0.5, 0.2); // Semi-transparent gray
-    })";
+SceneRenderer sceneRenderer;
+
+// Records the window to an image sequence without stalling the frame.
+// glReadPixels into a pixel pack buffer returns at once; the buffer is
+// mapped LAG frames later, when its fence has long been signalled, and the
+// pixels go to an encoder thread that flips them and writes the file. With
+// GL_ARB_buffer_storage the encoder reads the persistent mapping directly;
+// otherwise the mapping is copied out first. A slot is reused only once the
+// encoder is done with it, so an encoder that falls behind slows the frame
+// down instead of piling up memory.
+struct FrameCapture
+{
+    static const int SLOTS = 6;
+    static const int LAG = 2;
 
-// Grid data
-unsigned int gridVAO, gridVBO;
-std::vector<float> gridVertices;
+    enum SlotState
+    {
+        SLOT_FREE,
+        SLOT_READING, // glReadPixels issued, fence pending
+        SLOT_ENCODING // Handed to the encoder thread
+    };
 
-void createGrid(int size, int divisions)
-{
-    gridVertices.clear();
-    float step = (float)size / divisions;
-    float halfSize = size * 0.5f;
+    struct Slot
+    {
+        GLuint pbo = 0;
+        GLsizeiptr size = 0;
+        const uint8_t *mapped = nullptr; // Persistent mapping, if supported
+        std::vector<uint8_t> copy;       // Otherwise the pixels, copied out of the mapping
+        GLsync fence = nullptr;
+        int width = 0, height = 0;
+        int frame = 0;
+        SlotState state = SLOT_FREE;
+    };
+
+    Slot slots[SLOTS];
+    int next = 0;
+    int frameNumber = 0;
+    std::string pattern = "capture_{frame}.qoi"; // {frame}: frame number
+    bool active = false;
+
+    std::thread encoder;
+    std::mutex mutex;
+    std::condition_variable wake, released;
+    std::deque<int> queue; // Slots waiting for the encoder, oldest first
+    bool stopping = false;
+
+    void start()
+    {
+        if (!encoder.joinable())
+            encoder = std::thread(&FrameCapture::encoderLoop, this);
+        active = true;
+    }
 
-    // Create grid lines of XZ plane
-    for (int i = 0; i <= divisions; ++i)
+    // Hands every frame still in flight to the encoder and waits for it to finish
+    void stop()
     {
-        float pos = -halfSize + i * step;
+        for (int i = 0; i < SLOTS; ++i)
+            handOff(oldestReading());
+        std::unique_lock<std::mutex> lock(mutex);
+        released.wait(lock, [this]
+                      {
+                          for (const Slot &slot : slots)
+                              if (slot.state != SLOT_FREE)
+                                  return false;
+                          return true;
+                      });
+        active = false;
+    }
 
-        // X-axis lines (vertical in XZ plane)
-        gridVertices.push_back(pos);
-        gridVertices.push_back(0.0f);
-        gridVertices.push_back(-halfSize);
+    // Call with the frame drawn but not yet swapped: after the swap the back
+    // buffer's contents are undefined
+    void capture(int width, int height)
+    {
+        for (int i = 0; i < SLOTS; ++i)
+        {
+            int oldest = oldestReading();
+            if (oldest < 0 || slots[oldest].frame > frameNumber - LAG)
+                break;
+            handOff(oldest);
+        }
 
-        gridVertices.push_back(pos);
-        gridVertices.push_back(0.0f);
-        gridVertices.push_back(halfSize);
+        Slot &slot = slots[next];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            released.wait(lock, [&]
+                          {
+                              return slot.state == SLOT_FREE;
+                          });
+        }
+        GLsizeiptr size = GLsizeiptr(width) * height * 4;
+        if (size != slot.size)
+            allocate(slot, size);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glReadBuffer(GL_BACK);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.width = width;
+        slot.height = height;
+        slot.frame = frameNumber++;
+        slot.state = SLOT_READING;
+        next = (next + 1) % SLOTS;
+    }
 
-        // Z-axis lines (horizontal in XZ plane)
-        gridVertices.push_back(-halfSize);
-        gridVertices.push_back(0.0f);
-        gridVertices.push_back(pos);
+    void allocate(Slot &slot, GLsizeiptr size)
+    {
+        // Immutable storage cannot be resized, so the buffer is replaced
+        if (slot.pbo)
+        {
+            if (slot.mapped)
+            {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                slot.mapped = nullptr;
+            }
+            glDeleteBuffers(1, &slot.pbo);
+        }
+        glGenBuffers(1, &slot.pbo);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+        if (glBufferStorageARB)
+        {
+            GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorageARB(GL_PIXEL_PACK_BUFFER, size, nullptr, flags);
+            slot.mapped = static_cast<const uint8_t *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, flags));
+        }
+        else
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.size = size;
+    }
 
-        gridVertices.push_back(halfSize);
-        gridVertices.push_back(0.0f);
-        gridVertices.push_back(pos);
+    int oldestReading()
+    {
+        std::lock_guard<std::mutex> lock(mutex); // The encoder writes states too
+        int oldest = -1;
+        for (int i = 0; i < SLOTS; ++i)
+            if (slots[i].state == SLOT_READING && (oldest < 0 || slots[i].frame < slots[oldest].frame))
+                oldest = i;
+        return oldest;
     }
 
-    // Create grid lines of YZ plane
-    for (int i = 0; i <= divisions; ++i)
+    void handOff(int index)
     {
-        float pos = -halfSize + i * step;
+        if (index < 0)
+            return;
+        Slot &slot = slots[index];
+        while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+            ;
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+        if (!slot.mapped)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+            const void *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, slot.size, GL_MAP_READ_BIT);
+            slot.copy.resize(slot.size);
+            std::memcpy(slot.copy.data(), pixels, slot.size);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot.state = SLOT_ENCODING;
+            queue.push_back(index);
+        }
+        wake.notify_one();
+    }
 
-        // Y-axis lines (vertical in YZ plane)
-        gridVertices.push_back(0.0f);
-        gridVertices.push_back(pos);
-        gridVertices.push_back(halfSize);
+    std::string framePath(int frame) const
+    {
+        char number[16];
+        std::snprintf(number, sizeof(number), "%06d", frame);
+        std::string path = pattern;
+        for (size_t at; (at = path.find("{frame}")) != std::string::npos;)
+            path.replace(at, 7, number);
+        return path;
+    }
 
-        gridVertices.push_back(0.0f);
-        gridVertices.push_back(pos);
-        gridVertices.push_back(-halfSize);
+    void encoderLoop()
+    {
+        Image image;
+        for (;;)
+        {
+            int index;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]
+                          {
+                              return stopping || !queue.empty();
+                          });
+                if (queue.empty())
+                    return;
+                index = queue.front();
+                queue.pop_front();
+            }
 
-        // Z-axis lines (horizontal in YZ plane)
-        gridVertices.push_back(0.0f);
-        gridVertices.push_back(halfSize);
-        gridVertices.push_back(pos);
+            // GL rows run bottom up; images are top row first
+            Slot &slot = slots[index];
+            const uint8_t *rgba = slot.mapped ? slot.mapped : slot.copy.data();
+            image.width = slot.width;
+            image.height = slot.height;
+            image.pixels.resize(size_t(slot.width) * slot.height * 3);
+            for (int y = 0; y < slot.height; ++y)
+            {
+                const uint8_t *src = rgba + size_t(slot.height - 1 - y) * slot.width * 4;
+                uint8_t *dst = &image.pixels[size_t(y) * slot.width * 3];
+                for (int x = 0; x < slot.width; ++x)
+                {
+                    dst[x * 3] = src[x * 4];
+                    dst[x * 3 + 1] = src[x * 4 + 1];
+                    dst[x * 3 + 2] = src[x * 4 + 2];
+                }
+            }
+            write_image(framePath(slot.frame), image);
 
-        gridVertices.push_back(0.0f);
-        gridVertices.push_back(-halfSize);
-        gridVertices.push_back(pos);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot.state = SLOT_FREE;
+            }
+            released.notify_all();
+        }
     }
 
-    // Create grid lines of XY plane
-    for (int i = 0; i <= divisions; ++i)
+    void destroy()
     {
-        float pos = -halfSize + i * step;
+        if (active)
+            stop();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (encoder.joinable())
+            encoder.join();
+        stopping = false;
+        for (Slot &slot : slots)
+        {
+            if (slot.mapped)
+            {
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glDeleteBuffers(1, &slot.pbo);
+            slot = Slot();
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+};
 
-        // X-axis lines (vertical in XY plane)
-        gridVertices.push_back(pos);
-        gridVertices.push_back(-halfSize);
-        gridVertices.push_back(0.0f);
+FrameCapture frameCapture;
 
-        gridVertices.push_back(pos);
-        gridVertices.push_back(halfSize);
-        gridVertices.push_back(0.0f);
+// Builds a net by solid name, or from an OFF file
+bool build_named_net(const std::string &name)
+{
+    static const struct
+    {
+        const char *name;
+        void (*build)();
+    } solids[] = {
+        {"tetrahedron", build_tetrahedron_net},
+        {"hexahedron", build_hexahedron_net},
+        {"cube", build_hexahedron_net},
+        {"octahedron", build_octahedron_net},
+        {"dodecahedron", build_dodecahedron_net},
+        {"icosahedron", build_icosahedron_net},
+        {"cuboctahedron", build_cuboctahedron_net},
+        {"truncated_icosahedron", build_truncated_icosahedron_net},
+    };
+    for (const auto &solid : solids)
+        if (name == solid.name)
+        {
+            solid.build();
+            return true;
+        }
+    PolyhedronDesc desc;
+    return load_off_polyhedron(name.c_str(), desc) && build_net(desc);
+}
 
-        // Y-axis lines (horizontal in XY plane)
-        gridVertices.push_back(halfSize);
-        gridVertices.push_back(pos);
-        gridVertices.push_back(0.0f);
+// Batch rendering without a display: every net runs the same fold script
+// and writes an image at each "shot" (or once, at the end, if there are none)
+struct HeadlessJob
+{
+    std::vector<std::string> nets;
+    std::string script;
+    std::string outPattern = "{net}.png"; // {net}: net file or solid name, {shot}: shot or frame number,
+                                          // {frame}: the same, zero-padded
+    int width = 512, height = 512;
+    float fps = 0.0f;       // --animate: render the whole fold at this frame rate instead of the script
+    bool software = false;  // --renderer soft|ray: CPU rendering, no GL context at all
+    bool rayTraced = false; // --renderer ray
+    int samples = 16;       // Ray tracer samples per pixel
+    unsigned threads = 0;   // CPU renderer threads; 0 uses every core
+};
 
-        gridVertices.push_back(-halfSize);
-        gridVertices.push_back(pos);
-        gridVertices.push_back(0.0f);
+// A context with nothing to show. GLFW's null platform with OSMesa needs
+// no display server at all; failing that, a hidden window on whatever
+// platform is there. Frames go to an FBO either way, so the window's own
+// framebuffer is never used.
+GLFWwindow *create_headless_context()
+{
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        bool surfaceless = attempt == 0;
+        glfwInitHint(GLFW_PLATFORM, surfaceless ? GLFW_PLATFORM_NULL : GLFW_ANY_PLATFORM);
+        if (!glfwInit())
+            continue;
+        glfwDefaultWindowHints();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        if (surfaceless)
+            glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+        GLFWwindow *window = glfwCreateWindow(1, 1, "Polyhedron Net", NULL, NULL);
+        if (window)
+            return window;
+        glfwTerminate();
     }
-
-    // Setup grid VAO/VBO
-    glGenVertexArrays(1, &gridVAO);
-    glGenBuffers(1, &gridVBO);
-    glBindVertexArray(gridVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, gridVBO);
-    glBufferData(GL_ARRAY_BUFFER, gridVertices.size() * sizeof(float), gridVertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
+    return NULL;
 }
 
-// Helper functions for shader error checking
-void checkShaderCompile(unsigned int shader, const std::string &type)
+// Output file for one image. With numbered set (animation frames, or a
+// script with several shots) a pattern that cannot tell them apart gets
+// "_{frame}" or "_{shot}" before its extension.
+std::string headless_output_path(const HeadlessJob &job, const std::string &net, int shot, bool numbered)
 {
-    GLint success;
-    GLchar infoLog[1024];
-    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
-    if (!success)
+    std::string stem = net.substr(net.find_last_of("/\\") + 1);
+    stem = stem.substr(0, stem.rfind(".off") == stem.size() - 4 && stem.size() > 4 ? stem.size() - 4 : stem.size());
+    std::string path = job.outPattern;
+    if (numbered && path.find("{shot}") == std::string::npos && path.find("{frame}") == std::string::npos)
     {
-        glGetShaderInfoLog(shader, 1024, NULL, infoLog);
-        std::cout << "ERROR::SHADER_COMPILATION_ERROR of type: " << type << "\n"
-                  << infoLog << std::endl;
+        size_t dot = path.find_last_of('.');
+        size_t slash = path.find_last_of("/\\");
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash) || path.find("{net}", dot) != std::string::npos)
+            dot = path.size();
+        path.insert(dot, job.fps > 0.0f ? "_{frame}" : "_{shot}");
     }
+    for (size_t at; (at = path.find("{net}")) != std::string::npos;)
+        path.replace(at, 5, stem);
+    char padded[16];
+    std::snprintf(padded, sizeof(padded), "%06d", shot);
+    for (size_t at; (at = path.find("{shot}")) != std::string::npos;)
+        path.replace(at, 6, std::to_string(shot));
+    for (size_t at; (at = path.find("{frame}")) != std::string::npos;)
+        path.replace(at, 7, padded);
+    return path;
 }
 
-void checkProgramLink(unsigned int program, const std::string &type)
+int run_headless(const HeadlessJob &job)
 {
-    GLint success;
-    GLchar infoLog[1024];
-    glGetProgramiv(program, GL_LINK_STATUS, &success);
-    if (!success)
+    // Script words: next, all, undo, reset (as the F/Space/U/X keys) and shot
+    std::vector<std::string> steps;
+    std::string word;
+    for (char c : job.script + ",")
+        if (c == ',' || c == ' ' || c == ';')
+        {
+            if (!word.empty())
+                steps.push_back(word);
+            word.clear();
+        }
+        else
+            word += c;
+    for (const std::string &step : steps)
+        if (step != "next" && step != "all" && step != "undo" && step != "reset" && step != "shot")
+        {
+            std::cout << "ERROR::HEADLESS::UNKNOWN_SCRIPT_STEP " << step << std::endl;
+            return 1;
+        }
+    if (std::find(steps.begin(), steps.end(), "shot") == steps.end())
+        steps.push_back("shot");
+    bool numbered = job.fps > 0.0f || std::count(steps.begin(), steps.end(), "shot") > 1;
+
+    if (job.software)
     {
-        glGetProgramInfoLog(program, 1024, NULL, infoLog);
-        std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n"
-                  << infoLog << std::endl;
+        build_grid_vertices(20, 20);
+        threadPool.start(job.threads > 0 ? int(job.threads) - 1 : -1);
+    }
+    else
+    {
+        GLFWwindow *window = create_headless_context();
+        if (!window)
+        {
+            std::cout << "ERROR::HEADLESS::NO_CONTEXT" << std::endl;
+            return 1;
+        }
+        glfwMakeContextCurrent(window);
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            glfwTerminate();
+            return 1;
+        }
+        sceneRenderer.init();
+    }
+
+    // Draws the current palette into target
+    auto renderFrame = [&](Image &target)
+    {
+        if (job.software)
+        {
+            FramePhase phase = job.rayTraced ? PHASE_RAY : PHASE_SOFT;
+            frameProfiler.begin(phase);
+            if (job.rayTraced)
+                render_ray(target, job.width, job.height, job.samples, job.samples);
+            else
+                render_soft(target, job.width, job.height);
+            frameProfiler.end(phase);
+            // Nothing uploads the palette, so nothing else clears these
+            changedPolys.clear();
+            fullUploadPending = false;
+        }
+        else
+        {
+            sceneRenderer.draw(job.width, job.height, true);
+            sceneRenderer.readScene(target);
+            streamUploader.endFrame();
+        }
+    };
+
+    // Folds snap, so each shot shows the script's end state at that point
+    animateFolds = false;
+    int failures = 0;
+    Image image;
+    ImageWriter imageWriter;
+    imageWriter.start();
+
+    // Two queued writes to one path would race each other, so a repeat
+    // (the same net twice, or several nets and no {net}) is an error
+    std::unordered_set<std::string> queuedPaths;
+    auto queueImage = [&](const std::string &path)
+    {
+        if (!queuedPaths.insert(path).second)
+        {
+            std::cout << "ERROR::HEADLESS::DUPLICATE_OUTPUT " << path << std::endl;
+            ++failures;
+            return;
+        }
+        imageWriter.write(path, image);
+    };
+    for (const std::string &net : job.nets)
+    {
+        if (!build_named_net(net))
+        {
+            ++failures;
+            continue;
+        }
+        if (job.fps > 0.0f)
+        {
+            // A fixed timestep through the fold timeline, which follows the
+            // scheduler's foldDependents order from the flat net. Each frame
+            // depends only on its number, so a net always gives the same files.
+            int frames = int(std::ceil(foldTimeline.length() * job.fps)) + 1;
+            for (int frame = 0; frame < frames; ++frame)
+            {
+                frameProfiler.begin(PHASE_FRAME);
+                frameProfiler.begin(PHASE_FOLD);
+                float time = std::min(float(double(frame) / job.fps), foldTimeline.length());
+                foldTimeline.evaluate(time, palette);
+                fullUploadPending = true;
+                frameProfiler.end(PHASE_FOLD);
+                renderFrame(image);
+                frameProfiler.end(PHASE_FRAME);
+                frameProfiler.endFrame();
+                queueImage(headless_output_path(job, net, frame, numbered));
+            }
+            continue;
+        }
+        int shot = 0;
+        for (const std::string &step : steps)
+        {
+            if (step == "next")
+                foldScheduler.execute(FOLD_NEXT);
+            else if (step == "all")
+                foldScheduler.execute(FOLD_ALL);
+            else if (step == "undo")
+                foldScheduler.execute(UNFOLD_LAST);
+            else if (step == "reset")
+                foldScheduler.execute(FOLD_RESET);
+            else
+            {
+                frameProfiler.begin(PHASE_FRAME);
+                frameProfiler.begin(PHASE_BUILD);
+                if (buffersDirty)
+                {
+                    build_buffer();
+                    buffersDirty = false;
+                }
+                frameProfiler.end(PHASE_BUILD);
+                renderFrame(image);
+                frameProfiler.end(PHASE_FRAME);
+                frameProfiler.endFrame();
+                queueImage(headless_output_path(job, net, shot++, numbered));
+            }
+        }
+    }
+    failures += int(imageWriter.finish());
+
+    if (!profileCsvPath.empty())
+        frameProfiler.writeCsv(profileCsvPath);
+    threadPool.stop();
+    if (!job.software)
+    {
+        sceneRenderer.destroy();
+        glfwTerminate();
     }
+    return failures > 0 ? 1 : 0;
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    // Command line: [--profile-csv file] [--capture "frames/{frame}.qoi"] [net.off]
+    //           or: --headless [--net name|file.off]... [--script "all,shot"]
+    //               [--out "{net}_{shot}.png"] [--size WxH]
+    //               [--renderer gl|soft|ray] [--samples n] [--threads n] [--animate fps]
+    //               [net.off...]
+    const char *offPath = NULL;
+    bool headless = false;
+    HeadlessJob job;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--profile-csv" && i + 1 < argc)
+            profileCsvPath = argv[++i];
+        else if (arg == "--capture" && i + 1 < argc)
+        {
+            frameCapture.pattern = argv[++i];
+            captureFrames = true;
+        }
+        else if (arg == "--headless")
+            headless = true;
+        else if (arg == "--net" && i + 1 < argc)
+            job.nets.push_back(argv[++i]);
+        else if (arg == "--script" && i + 1 < argc)
+            job.script = argv[++i];
+        else if (arg == "--out" && i + 1 < argc)
+            job.outPattern = argv[++i];
+        else if (arg == "--renderer" && i + 1 < argc)
+        {
+            std::string renderer = argv[++i];
+            job.software = renderer == "soft" || renderer == "ray";
+            job.rayTraced = renderer == "ray";
+        }
+        else if (arg == "--animate" && i + 1 < argc)
+            job.fps = std::max(0.0f, float(std::atof(argv[++i])));
+        else if (arg == "--samples" && i + 1 < argc)
+            job.samples = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--threads" && i + 1 < argc)
+            job.threads = unsigned(std::max(1, std::atoi(argv[++i])));
+        else if (arg == "--size" && i + 1 < argc)
+        {
+            if (std::sscanf(argv[++i], "%dx%d", &job.width, &job.height) != 2 || job.width <= 0 || job.height <= 0)
+            {
+                std::cout << "ERROR::ARGS::BAD_SIZE " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+        else
+        {
+            offPath = argv[i];
+            job.nets.push_back(argv[i]);
+        }
+    }
+    if (headless)
+    {
+        if (job.nets.empty())
+            job.nets.push_back("tetrahedron");
+        return run_headless(job);
+    }
+
     // Initialize GLFW
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -724,6 +3288,9 @@ int main()
     }
     glfwMakeContextCurrent(window);
     glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetKeyCallback(window, key_callback);
+    glfwSetWindowRefreshCallback(window, window_refresh_callback);
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
     // Load GLAD
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
@@ -732,146 +3299,86 @@ int main()
         return -1;
     }
 
-    // Compile shaders
-    // Face shaders
-    unsigned int faceVertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(faceVertexShader, 1, &vertexShaderSource, NULL);
-    glCompileShader(faceVertexShader);
-    checkShaderCompile(faceVertexShader, "Face Vertex");
-
-    unsigned int faceFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(faceFragmentShader, 1, &fragmentShaderSource, NULL);
-    glCompileShader(faceFragmentShader);
-    checkShaderCompile(faceFragmentShader, "Face Fragment");
-
-    unsigned int faceShaderProgram = glCreateProgram();
-    glAttachShader(faceShaderProgram, faceVertexShader);
-    glAttachShader(faceShaderProgram, faceFragmentShader);
-    glLinkProgram(faceShaderProgram);
-    checkProgramLink(faceShaderProgram, "Face");
-
-    // Edge shaders
-    unsigned int edgeVertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(edgeVertexShader, 1, &edgeVertexShaderSource, NULL);
-    glCompileShader(edgeVertexShader);
-    checkShaderCompile(edgeVertexShader, "Edge Vertex");
-
-    unsigned int edgeFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(edgeFragmentShader, 1, &edgeFragmentShaderSource, NULL);
-    glCompileShader(edgeFragmentShader);
-    checkShaderCompile(edgeFragmentShader, "Edge Fragment");
-
-    unsigned int edgeShaderProgram = glCreateProgram();
-    glAttachShader(edgeShaderProgram, edgeVertexShader);
-    glAttachShader(edgeShaderProgram, edgeFragmentShader);
-    glLinkProgram(edgeShaderProgram);
-    checkProgramLink(edgeShaderProgram, "Edge");
-
-    // Clean up shaders
-    glDeleteShader(faceVertexShader);
-    glDeleteShader(faceFragmentShader);
-    glDeleteShader(edgeVertexShader);
-    glDeleteShader(edgeFragmentShader);
-
-    // Generate buffers
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenVertexArrays(1, &faceVAO);
-    glGenBuffers(1, &faceVBO);
-
-    // Set up edge VAO
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
-
-    // Set up face VAO
-    glBindVertexArray(faceVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, faceVBO);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
-    glEnableVertexAttribArray(0);
-
-    // Create grid shader program
-    unsigned int gridVertexShader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(gridVertexShader, 1, &gridVertexShaderSource, NULL);
-    glCompileShader(gridVertexShader);
+    sceneRenderer.init();
 
-    unsigned int gridFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(gridFragmentShader, 1, &gridFragmentShaderSource, NULL);
-    glCompileShader(gridFragmentShader);
-
-    unsigned int gridShaderProgram = glCreateProgram();
-    glAttachShader(gridShaderProgram, gridVertexShader);
-    glAttachShader(gridShaderProgram, gridFragmentShader);
-    glLinkProgram(gridShaderProgram);
-
-    glDeleteShader(gridVertexShader);
-    glDeleteShader(gridFragmentShader);
-
-    createGrid(20, 20);
-
-    // Enable blending and depth testing
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    // Initial geometry
-    build_tetrahedron_net();
+    // Initial geometry: an OFF file given on the command line, or a tetrahedron
+    PolyhedronDesc desc;
+    if (!offPath || !load_off_polyhedron(offPath, desc) || !build_net(desc))
+        build_tetrahedron_net();
 
     // Main render loop
+    double lastFrame = glfwGetTime();
     while (!glfwWindowShouldClose(window))
     {
-        processInput(window);
-
-        // Clear buffers
-        glClearColor(0.05f, 0.05f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        // Camera setup
-        glm::mat4 projection = glm::perspective(glm::radians(45.0f),
-                                                (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = glm::lookAt(
-            glm::vec3(camX, camY, camZ),
-            glm::vec3(centerX, centerY, centerZ),
-            glm::vec3(0.0f, 1.0f, 0.0f)
-        );
+        double now = glfwGetTime();
+        float deltaTime = float(now - lastFrame);
+        lastFrame = now;
+        frameProfiler.begin(PHASE_FRAME);
 
-        display_polygons();
-
-        // 1. Draw grid first (behind everything)
-        glUseProgram(gridShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(gridShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(gridShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glBindVertexArray(gridVAO);
-        glDrawArrays(GL_LINES, 0, gridVertices.size() / 3);
+        frameProfiler.begin(PHASE_INPUT);
+        processInput(window);
+        frameProfiler.end(PHASE_INPUT);
+        frameProfiler.begin(PHASE_FOLD);
+        advance_fold_animation(deltaTime);
+        frameProfiler.end(PHASE_FOLD);
+
+        // Rebuild geometry at most once per frame, however many polygons changed
+        frameProfiler.begin(PHASE_BUILD);
+        if (buffersDirty)
+        {
+            build_buffer();
+            buffersDirty = false;
+        }
+        frameProfiler.end(PHASE_BUILD);
 
-        // 2. Draw faces (with depth test but no writing)
-        glDepthMask(GL_FALSE);
-        glUseProgram(faceShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(faceShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(faceShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glBindVertexArray(faceVAO);
-        glDrawArrays(GL_TRIANGLES, 0, faceBuffer.size() / 3);
-        glDepthMask(GL_TRUE);
+        // Draw offscreen when the faces need the OIT targets
+        int fbWidth, fbHeight;
+        glfwGetFramebufferSize(window, &fbWidth, &fbHeight);
+        if (softwareRender || rayTrace)
+            sceneRenderer.drawSoftware(fbWidth, fbHeight, rayTrace);
+        else
+        {
+            sceneRenderer.draw(fbWidth, fbHeight, orderIndependent);
+            if (orderIndependent)
+                transparencyTargets.present();
+        }
 
-        // 2. Draw edges (with depth writing)
-        glUseProgram(edgeShaderProgram);
-        glUniformMatrix4fv(glGetUniformLocation(edgeShaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(edgeShaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_LINES, 0, buffer.size() / 3);
+        frameProfiler.begin(PHASE_CAPTURE);
+        if (captureFrames != frameCapture.active)
+        {
+            if (captureFrames)
+                frameCapture.start();
+            else
+                frameCapture.stop();
+        }
+        if (frameCapture.active)
+            frameCapture.capture(fbWidth, fbHeight);
+        frameProfiler.end(PHASE_CAPTURE);
 
+        streamUploader.endFrame();
         glfwSwapBuffers(window);
+        frameProfiler.end(PHASE_FRAME);
+        frameProfiler.endFrame();
+        sceneDirty = false;
         glfwPollEvents();
+
+        // Idle: sleep until an event changes something. Events that do not
+        // (cursor motion, say) go straight back to sleep. The time asleep is
+        // not animation time, so the next frame starts its clock afresh.
+        if (renderOnDemand)
+            while (!frameNeeded(window) && !glfwWindowShouldClose(window))
+            {
+                glfwWaitEvents();
+                lastFrame = glfwGetTime();
+            }
     }
 
     // Cleanup
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteVertexArrays(1, &faceVAO);
-    glDeleteBuffers(1, &faceVBO);
-    glDeleteProgram(faceShaderProgram);
-    glDeleteProgram(edgeShaderProgram);
+    if (!profileCsvPath.empty())
+        frameProfiler.writeCsv(profileCsvPath);
+    threadPool.stop();
+    frameCapture.destroy();
+    sceneRenderer.destroy();
 
     glfwTerminate();
     return 0;
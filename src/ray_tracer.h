@@ -0,0 +1,423 @@
+// ray_tracer.h - Progressive CPU ray tracer for still images of folded nets
+#pragma once
+
+#ifndef GLM_ENABLE_EXPERIMENTAL
+#define GLM_ENABLE_EXPERIMENTAL
+#endif
+#include <glm/glm.hpp>
+#include <glm/gtx/intersect.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "image_io.h"
+#include "soft_raster.h"
+#include "thread_pool.h"
+
+// Bounding volume hierarchy over world-space triangles, built top-down
+// with a binned surface area heuristic. Nodes are stored depth-first: an
+// inner node's left child follows it and only the right one needs an index.
+struct Bvh
+{
+    static const int BINS = 16;
+    static const uint32_t MAX_LEAF = 4;
+    static const int MAX_DEPTH = 48;
+
+    struct Node
+    {
+        glm::vec3 lo;
+        uint32_t offset; // Leaf: first triangle; inner node: right child
+        glm::vec3 hi;
+        uint32_t count; // Triangles in a leaf; 0 for inner nodes
+    };
+
+    struct Triangle
+    {
+        glm::vec3 v0, v1, v2;
+        uint32_t id; // Position in the index list the BVH was built from
+    };
+
+    struct Hit
+    {
+        float distance;
+        glm::vec2 bary; // Weights of v1 and v2
+        uint32_t triangle;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles;
+    std::vector<glm::vec3> centroids;
+
+    void build(const std::vector<glm::vec3> &vertices, const std::vector<uint32_t> &indices)
+    {
+        nodes.clear();
+        triangles.clear();
+        centroids.clear();
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+        {
+            Triangle tri{vertices[indices[t]], vertices[indices[t + 1]], vertices[indices[t + 2]], uint32_t(t / 3)};
+            triangles.push_back(tri);
+            centroids.push_back((tri.v0 + tri.v1 + tri.v2) / 3.0f);
+        }
+        if (!triangles.empty())
+            buildNode(0, uint32_t(triangles.size()), 0);
+    }
+
+    static float area(const glm::vec3 &lo, const glm::vec3 &hi)
+    {
+        glm::vec3 d = glm::max(hi - lo, glm::vec3(0.0f));
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    uint32_t buildNode(uint32_t first, uint32_t count, int depth)
+    {
+        uint32_t index = uint32_t(nodes.size());
+        nodes.push_back(Node());
+        glm::vec3 lo(1e30f), hi(-1e30f), centreLo(1e30f), centreHi(-1e30f);
+        for (uint32_t i = first; i < first + count; ++i)
+        {
+            const Triangle &t = triangles[i];
+            lo = glm::min(lo, glm::min(t.v0, glm::min(t.v1, t.v2)));
+            hi = glm::max(hi, glm::max(t.v0, glm::max(t.v1, t.v2)));
+            centreLo = glm::min(centreLo, centroids[i]);
+            centreHi = glm::max(centreHi, centroids[i]);
+        }
+        nodes[index].lo = lo;
+        nodes[index].hi = hi;
+        nodes[index].offset = first;
+        nodes[index].count = count;
+        if (count <= MAX_LEAF || depth >= MAX_DEPTH)
+            return index;
+
+        // Best bin boundary on the axis the centroids spread furthest along
+        glm::vec3 extent = centreHi - centreLo;
+        int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+        uint32_t middle = first + count / 2;
+        if (extent[axis] > 0.0f)
+        {
+            glm::vec3 binLo[BINS], binHi[BINS];
+            uint32_t binCount[BINS] = {};
+            for (int b = 0; b < BINS; ++b)
+            {
+                binLo[b] = glm::vec3(1e30f);
+                binHi[b] = glm::vec3(-1e30f);
+            }
+            float scale = BINS / extent[axis];
+            auto binOf = [&](uint32_t i)
+            {
+                return std::min(BINS - 1, int((centroids[i][axis] - centreLo[axis]) * scale));
+            };
+            for (uint32_t i = first; i < first + count; ++i)
+            {
+                int b = binOf(i);
+                const Triangle &t = triangles[i];
+                binLo[b] = glm::min(binLo[b], glm::min(t.v0, glm::min(t.v1, t.v2)));
+                binHi[b] = glm::max(binHi[b], glm::max(t.v0, glm::max(t.v1, t.v2)));
+                ++binCount[b];
+            }
+            float rightArea[BINS];
+            uint32_t rightCount[BINS];
+            glm::vec3 accLo(1e30f), accHi(-1e30f);
+            uint32_t accCount = 0;
+            for (int b = BINS - 1; b > 0; --b)
+            {
+                accLo = glm::min(accLo, binLo[b]);
+                accHi = glm::max(accHi, binHi[b]);
+                accCount += binCount[b];
+                rightArea[b] = area(accLo, accHi);
+                rightCount[b] = accCount;
+            }
+            float bestCost = area(lo, hi) * count;
+            int bestSplit = 0;
+            accLo = glm::vec3(1e30f);
+            accHi = glm::vec3(-1e30f);
+            accCount = 0;
+            for (int b = 1; b < BINS; ++b)
+            {
+                accLo = glm::min(accLo, binLo[b - 1]);
+                accHi = glm::max(accHi, binHi[b - 1]);
+                accCount += binCount[b - 1];
+                if (accCount == 0 || rightCount[b] == 0)
+                    continue;
+                float cost = area(accLo, accHi) * accCount + rightArea[b] * rightCount[b];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestSplit = b;
+                }
+            }
+            if (bestSplit == 0)
+                return index; // Splitting costs more than testing every triangle
+
+            middle = first;
+            for (uint32_t i = first; i < first + count; ++i)
+                if (binOf(i) < bestSplit)
+                {
+                    std::swap(triangles[i], triangles[middle]);
+                    std::swap(centroids[i], centroids[middle]);
+                    ++middle;
+                }
+        }
+        else
+        {
+            // Every centroid in one place: no split tells them apart, so halve
+            if (count <= 2 * MAX_LEAF)
+                return index;
+        }
+
+        nodes[index].count = 0;
+        buildNode(first, middle - first, depth + 1);
+        uint32_t right = buildNode(middle, first + count - middle, depth + 1);
+        nodes[index].offset = right;
+        return index;
+    }
+
+    static bool hitBox(const Node &node, const glm::vec3 &origin, const glm::vec3 &invDir, float tMax, float &tNear)
+    {
+        glm::vec3 t0 = (node.lo - origin) * invDir, t1 = (node.hi - origin) * invDir;
+        glm::vec3 tMin3 = glm::min(t0, t1), tMax3 = glm::max(t0, t1);
+        tNear = std::max(std::max(tMin3.x, tMin3.y), std::max(tMin3.z, 0.0f));
+        float tFar = std::min(std::min(tMax3.x, tMax3.y), std::min(tMax3.z, tMax));
+        return tNear <= tFar;
+    }
+
+    // Nearest hit closer than tMax, or with anyHit the first one found (for
+    // shadow and occlusion rays, which only ask whether there is one)
+    bool intersect(const glm::vec3 &origin, const glm::vec3 &dir, float tMax, bool anyHit, Hit &hit) const
+    {
+        if (nodes.empty())
+            return false;
+        glm::vec3 invDir = 1.0f / dir;
+        struct Entry
+        {
+            uint32_t node;
+            float tNear;
+        } stack[MAX_DEPTH + 2];
+        int top = 0;
+        float tNear;
+        if (!hitBox(nodes[0], origin, invDir, tMax, tNear))
+            return false;
+        stack[top++] = {0, tNear};
+        bool found = false;
+        while (top > 0)
+        {
+            Entry entry = stack[--top];
+            if (entry.tNear > tMax)
+                continue;
+            uint32_t index = entry.node;
+            for (;;)
+            {
+                const Node &node = nodes[index];
+                if (node.count > 0)
+                {
+                    for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+                    {
+                        const Triangle &t = triangles[i];
+                        glm::vec2 bary;
+                        float distance;
+                        if (glm::intersectRayTriangle(origin, dir, t.v0, t.v1, t.v2, bary, distance) &&
+                            distance > 0.0f && distance < tMax)
+                        {
+                            tMax = distance;
+                            hit = {distance, bary, i};
+                            found = true;
+                            if (anyHit)
+                                return true;
+                        }
+                    }
+                    break;
+                }
+                // Visit the nearer child first; the other waits on the stack
+                uint32_t left = index + 1, right = node.offset;
+                float tLeft, tRight;
+                bool hitLeft = hitBox(nodes[left], origin, invDir, tMax, tLeft);
+                bool hitRight = hitBox(nodes[right], origin, invDir, tMax, tRight);
+                if (hitLeft && hitRight)
+                {
+                    if (tRight < tLeft)
+                    {
+                        std::swap(left, right);
+                        std::swap(tLeft, tRight);
+                    }
+                    stack[top++] = {right, tRight};
+                    index = left;
+                }
+                else if (hitLeft)
+                    index = left;
+                else if (hitRight)
+                    index = right;
+                else
+                    break;
+            }
+        }
+        return found;
+    }
+};
+
+// Progressive ray tracer for stills. Every refine() adds one sample to each
+// pixel: a jittered camera ray, then from its hit a shadow ray towards a
+// soft key light and an ambient occlusion ray. Faces are the viewer's grey,
+// made opaque, and polygon outlines (not fan diagonals) are inked at a
+// constant width in pixels. Random numbers are hashed from pixel and sample
+// index, so the image does not depend on how tiles fall to threads.
+struct RayTracer
+{
+    static const int TILE = 32;
+
+    ThreadPool *pool = nullptr;
+    Bvh bvh;
+    int width = 0, height = 0, samples = 0;
+    std::vector<glm::vec3> accum; // Linear colour sums, top row first
+    std::vector<uint8_t> diagonals;
+
+    // What the accumulated samples show; any change restarts them
+    glm::mat4 projection{0.0f}, view{0.0f};
+    std::vector<glm::vec3> vertices;
+    std::vector<uint32_t> faceIndices;
+
+    glm::mat4 inverseViewProjection{1.0f};
+    glm::vec3 eye{0.0f}, lightDir{0.0f, 1.0f, 0.0f}, lightU{1.0f, 0.0f, 0.0f}, lightV{0.0f, 0.0f, 1.0f};
+    float pixelAngle = 0.0f; // Width of a pixel per unit of distance
+    float occlusionRange = 1.0f, epsilon = 1e-4f;
+
+    bool sameScene(const SoftScene &scene) const
+    {
+        return scene.width == width && scene.height == height && scene.projection == projection &&
+               scene.view == view && scene.vertices == vertices && *scene.faceIndices == faceIndices;
+    }
+
+    // Builds the BVH and clears the accumulated samples
+    void begin(const SoftScene &scene)
+    {
+        width = scene.width;
+        height = scene.height;
+        projection = scene.projection;
+        view = scene.view;
+        vertices = scene.vertices;
+        faceIndices = *scene.faceIndices;
+        diagonals = scene.diagonals;
+        bvh.build(vertices, faceIndices);
+        samples = 0;
+        accum.assign(size_t(width) * height, glm::vec3(0.0f));
+
+        inverseViewProjection = glm::inverse(projection * view);
+        glm::mat4 camera = glm::inverse(view);
+        eye = glm::vec3(camera[3]);
+        glm::vec3 right(camera[0]), up(camera[1]), back(camera[2]);
+        lightDir = glm::normalize(-0.4f * right + 0.8f * up + 0.6f * back);
+        lightU = glm::normalize(glm::cross(lightDir, std::fabs(lightDir.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0)));
+        lightV = glm::cross(lightDir, lightU);
+        pixelAngle = 2.0f / (projection[1][1] * height);
+
+        float size = bvh.nodes.empty() ? 1.0f : glm::length(bvh.nodes[0].hi - bvh.nodes[0].lo);
+        occlusionRange = 0.25f * size;
+        epsilon = 1e-5f * std::max(size, glm::length(eye));
+    }
+
+    void refine()
+    {
+        int tilesX = (width + TILE - 1) / TILE, tilesY = (height + TILE - 1) / TILE;
+        uint32_t sampleIndex = uint32_t(samples);
+        auto traceTile = [&](size_t tile)
+        {
+            int x0 = int(tile % tilesX) * TILE, y0 = int(tile / tilesX) * TILE;
+            for (int y = y0; y < std::min(y0 + TILE, height); ++y)
+                for (int x = x0; x < std::min(x0 + TILE, width); ++x)
+                    accum[size_t(y) * width + x] += sample(x, y, sampleIndex);
+        };
+        size_t tileCount = size_t(tilesX) * tilesY;
+        if (pool)
+            pool->parallelFor(tileCount, traceTile);
+        else
+            for (size_t tile = 0; tile < tileCount; ++tile)
+                traceTile(tile);
+        ++samples;
+    }
+
+    // Average of the samples so far, gamma encoded
+    void resolve(Image &image) const
+    {
+        image.width = width;
+        image.height = height;
+        image.pixels.resize(size_t(width) * height * 3);
+        float scale = samples > 0 ? 1.0f / samples : 0.0f;
+        for (size_t i = 0; i < accum.size(); ++i)
+            for (int k = 0; k < 3; ++k)
+            {
+                float c = std::pow(glm::clamp(accum[i][k] * scale, 0.0f, 1.0f), 1.0f / 2.2f);
+                image.pixels[i * 3 + k] = uint8_t(c * 255.0f + 0.5f);
+            }
+    }
+
+    static uint32_t hash(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7FEB352Du;
+        x ^= x >> 15;
+        x *= 0x846CA68Bu;
+        x ^= x >> 16;
+        return x;
+    }
+
+    struct Random
+    {
+        uint32_t state;
+
+        float next()
+        {
+            state = hash(state);
+            return (state >> 8) * (1.0f / 16777216.0f);
+        }
+    };
+
+    // One sample of pixel (x, y), counted from the top row
+    glm::vec3 sample(int x, int y, uint32_t sampleIndex) const
+    {
+        Random random{hash(uint32_t(y * width + x) ^ hash(sampleIndex + 0x9E3779B9u))};
+        float px = x + random.next(), py = height - y - random.next();
+        glm::vec4 far = inverseViewProjection * glm::vec4(2.0f * px / width - 1.0f, 2.0f * py / height - 1.0f, 1.0f, 1.0f);
+        glm::vec3 dir = glm::normalize(glm::vec3(far) / far.w - eye);
+
+        Bvh::Hit hit;
+        if (!bvh.intersect(eye, dir, 1e30f, false, hit))
+            return glm::pow(glm::vec3(0.05f, 0.05f, 0.1f), glm::vec3(2.2f)); // The viewer's clear colour
+
+        const Bvh::Triangle &t = bvh.triangles[hit.triangle];
+        glm::vec3 e1 = t.v1 - t.v0, e2 = t.v2 - t.v0;
+        glm::vec3 normal = glm::cross(e1, e2);
+        float doubleArea = glm::length(normal);
+        normal /= doubleArea;
+        if (glm::dot(normal, dir) > 0.0f)
+            normal = -normal;
+
+        // Ink within 0.75 px of an outline edge; edge k lies opposite corner k
+        glm::vec3 weights(1.0f - hit.bary.x - hit.bary.y, hit.bary.x, hit.bary.y);
+        glm::vec3 opposite(glm::length(t.v2 - t.v1), glm::length(e2), glm::length(e1));
+        uint8_t diagonal = t.id < diagonals.size() ? diagonals[t.id] : 0;
+        float halfWidth = 0.75f * pixelAngle * hit.distance;
+        for (int k = 0; k < 3; ++k)
+            if (!(diagonal & (1 << k)) && weights[k] * doubleArea / opposite[k] < halfWidth)
+                return glm::vec3(0.0f);
+
+        glm::vec3 point = eye + hit.distance * dir + epsilon * normal;
+        Bvh::Hit blocker;
+
+        // Key light through a small disc, for soft shadow edges
+        float r = 0.08f * std::sqrt(random.next()), phi = 6.2831853f * random.next();
+        glm::vec3 toLight = glm::normalize(lightDir + r * (std::cos(phi) * lightU + std::sin(phi) * lightV));
+        float direct = std::max(glm::dot(normal, toLight), 0.0f);
+        if (direct > 0.0f && bvh.intersect(point, toLight, 1e30f, true, blocker))
+            direct = 0.0f;
+
+        // Cosine-weighted hemisphere ray; unoccluded ones see the sky
+        float u = random.next(), v = 6.2831853f * random.next();
+        glm::vec3 tangent = glm::normalize(glm::cross(normal, std::fabs(normal.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0)));
+        glm::vec3 bitangent = glm::cross(normal, tangent);
+        glm::vec3 skyDir = std::sqrt(u) * (std::cos(v) * tangent + std::sin(v) * bitangent) + std::sqrt(1.0f - u) * normal;
+        float sky = bvh.intersect(point, skyDir, occlusionRange, true, blocker) ? 0.0f : 1.0f;
+
+        return glm::vec3(0.8f) * (0.35f * sky + 0.85f * direct);
+    }
+};
@@ -0,0 +1,583 @@
+// soft_raster.h - Tile-based CPU rasterizer that mirrors the GL draw passes
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "image_io.h"
+#include "thread_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFT_RASTER_SSE2 1
+#endif
+
+// One frame's worth of geometry and state, already in world space. The
+// index lists are the ones the GL path draws, in the same order.
+struct SoftScene
+{
+    int width = 0, height = 0;
+    glm::mat4 projection{1.0f}, view{1.0f};
+    std::vector<glm::vec3> vertices;              // Net vertices with palette and model applied
+    const std::vector<uint32_t> *faceIndices = nullptr;
+    const std::vector<uint32_t> *edgeIndices = nullptr;
+    std::vector<uint8_t> diagonals;               // Per triangle, bit k when the edge opposite corner k is a fan diagonal
+    const std::vector<float> *gridVertices = nullptr; // Line list, xyz, for the mesh grid
+    bool proceduralGrid = true, wireframe = false, orderIndependent = true;
+};
+
+// Draws a SoftScene the way SceneRenderer::draw does: the same passes in
+// the same order, GL_LESS depth testing, the same depth writes and blending,
+// and GL's pixel-centre and top-left coverage rules. The target is cut into
+// tiles; primitives are binned to the tiles they touch in submission order,
+// then every tile runs all passes on its own thread, so tiles need no locks
+// and the result does not depend on the thread count.
+struct SoftRasterizer
+{
+    static const int TILE = 64;
+
+    struct Vertex
+    {
+        float x, y, z, invW; // Window coordinates, as gl_FragCoord
+        glm::vec3 bary;      // Wireframe barycentrics, perspective-correct
+    };
+
+    // Edge k is opposite corner k: e = a * x + b * y + c, positive inside
+    struct Triangle
+    {
+        Vertex v[3];
+        float a[3], b[3], c[3];
+        bool topLeft[3];
+        float invArea, zdx, zdy, zc; // Depth as a plane in window space
+        int minX, minY, maxX, maxY;
+        uint8_t diagonals;
+    };
+
+    struct Line
+    {
+        float x0, y0, z0, x1, y1, z1;
+    };
+
+    struct TileBuffers
+    {
+        glm::vec4 color[TILE * TILE];
+        uint32_t depth[TILE * TILE]; // 24-bit fixed point, like GL_DEPTH_COMPONENT24
+        glm::vec4 accum[TILE * TILE]; // OIT: premultiplied colour sum, revealage in alpha
+        float weight[TILE * TILE];
+    };
+
+    ThreadPool *pool = nullptr;
+    int width = 0, height = 0, tilesX = 0, tilesY = 0;
+    std::vector<glm::vec4> clip;
+    std::vector<Triangle> triangles;
+    std::vector<Line> gridLines, edges;
+    std::vector<std::vector<uint32_t>> faceBins, gridBins, edgeBins;
+
+    void render(const SoftScene &scene, Image &image)
+    {
+        width = scene.width;
+        height = scene.height;
+        tilesX = (width + TILE - 1) / TILE;
+        tilesY = (height + TILE - 1) / TILE;
+        size_t tileCount = size_t(tilesX) * tilesY;
+        for (auto *bins : {&faceBins, &gridBins, &edgeBins})
+        {
+            bins->resize(tileCount);
+            for (auto &bin : *bins)
+                bin.clear();
+        }
+
+        glm::mat4 viewProjection = scene.projection * scene.view;
+        clip.resize(scene.vertices.size());
+        for (size_t i = 0; i < clip.size(); ++i)
+            clip[i] = viewProjection * glm::vec4(scene.vertices[i], 1.0f);
+
+        triangles.clear();
+        const std::vector<uint32_t> &faces = *scene.faceIndices;
+        for (size_t t = 0; t + 2 < faces.size(); t += 3)
+            setupTriangle(clip[faces[t]], clip[faces[t + 1]], clip[faces[t + 2]],
+                          t / 3 < scene.diagonals.size() ? scene.diagonals[t / 3] : 0);
+        for (uint32_t i = 0; i < triangles.size(); ++i)
+            bin(faceBins, triangles[i].minX, triangles[i].minY, triangles[i].maxX, triangles[i].maxY, i);
+
+        edges.clear();
+        const std::vector<uint32_t> &edgeList = *scene.edgeIndices;
+        for (size_t e = 0; e + 1 < edgeList.size(); e += 2)
+            setupLine(edges, clip[edgeList[e]], clip[edgeList[e + 1]]);
+        binLines(edgeBins, edges);
+
+        gridLines.clear();
+        if (!scene.proceduralGrid && scene.gridVertices)
+        {
+            const std::vector<float> &g = *scene.gridVertices;
+            for (size_t i = 0; i + 5 < g.size(); i += 6)
+                setupLine(gridLines, viewProjection * glm::vec4(g[i], g[i + 1], g[i + 2], 1.0f),
+                          viewProjection * glm::vec4(g[i + 3], g[i + 4], g[i + 5], 1.0f));
+            binLines(gridBins, gridLines);
+        }
+
+        image.width = width;
+        image.height = height;
+        image.pixels.resize(size_t(width) * height * 3);
+        auto drawTile = [&](size_t tile)
+        {
+            renderTile(scene, int(tile % tilesX), int(tile / tilesX), image);
+        };
+        if (pool)
+            pool->parallelFor(tileCount, drawTile);
+        else
+            for (size_t tile = 0; tile < tileCount; ++tile)
+                drawTile(tile);
+    }
+
+    // Window position snapped to 1/256 pixel, the subpixel precision GL
+    // rasterizers use, so coverage ties resolve the same way
+    Vertex toWindow(const glm::vec4 &c, const glm::vec3 &bary) const
+    {
+        float invW = 1.0f / c.w;
+        float x = std::round((c.x * invW * 0.5f + 0.5f) * width * 256.0f) / 256.0f;
+        float y = std::round((c.y * invW * 0.5f + 0.5f) * height * 256.0f) / 256.0f;
+        return {x, y, c.z * invW * 0.5f + 0.5f, invW, bary};
+    }
+
+    // Clips against the near plane only; the tile bounds take care of the
+    // sides and the depth test of the far plane
+    void setupTriangle(const glm::vec4 &c0, const glm::vec4 &c1, const glm::vec4 &c2, uint8_t diagonals)
+    {
+        glm::vec4 in[3] = {c0, c1, c2};
+        glm::vec3 inBary[3] = {glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1)};
+        glm::vec4 out[4];
+        glm::vec3 outBary[4];
+        int n = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            int j = (i + 1) % 3;
+            float di = in[i].z + in[i].w, dj = in[j].z + in[j].w;
+            if (di >= 0.0f)
+            {
+                out[n] = in[i];
+                outBary[n++] = inBary[i];
+            }
+            if ((di >= 0.0f) != (dj >= 0.0f))
+            {
+                float t = di / (di - dj);
+                out[n] = in[i] + t * (in[j] - in[i]);
+                outBary[n++] = inBary[i] + t * (inBary[j] - inBary[i]);
+            }
+        }
+        for (int i = 1; i + 1 < n; ++i)
+            addTriangle(toWindow(out[0], outBary[0]), toWindow(out[i], outBary[i]),
+                        toWindow(out[i + 1], outBary[i + 1]), diagonals);
+    }
+
+    void addTriangle(Vertex v0, Vertex v1, Vertex v2, uint8_t diagonals)
+    {
+        Triangle t;
+        t.v[0] = v0;
+        t.v[1] = v1;
+        t.v[2] = v2;
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+        if (area == 0.0f || !std::isfinite(area))
+            return;
+        // Faces are not culled; clockwise ones are turned round
+        if (area < 0.0f)
+        {
+            std::swap(t.v[1], t.v[2]);
+            area = -area;
+        }
+        for (int k = 0; k < 3; ++k)
+        {
+            const Vertex &p = t.v[(k + 1) % 3], &q = t.v[(k + 2) % 3];
+            t.a[k] = p.y - q.y;
+            t.b[k] = q.x - p.x;
+            t.c[k] = -(t.a[k] * p.x + t.b[k] * p.y);
+            t.topLeft[k] = (q.y == p.y && q.x < p.x) || q.y < p.y;
+        }
+        t.invArea = 1.0f / area;
+        t.zdx = (t.a[0] * t.v[0].z + t.a[1] * t.v[1].z + t.a[2] * t.v[2].z) * t.invArea;
+        t.zdy = (t.b[0] * t.v[0].z + t.b[1] * t.v[1].z + t.b[2] * t.v[2].z) * t.invArea;
+        t.zc = (t.c[0] * t.v[0].z + t.c[1] * t.v[1].z + t.c[2] * t.v[2].z) * t.invArea;
+        float minX = std::min({t.v[0].x, t.v[1].x, t.v[2].x}), maxX = std::max({t.v[0].x, t.v[1].x, t.v[2].x});
+        float minY = std::min({t.v[0].y, t.v[1].y, t.v[2].y}), maxY = std::max({t.v[0].y, t.v[1].y, t.v[2].y});
+        t.minX = int(std::max(0.0f, std::floor(minX)));
+        t.minY = int(std::max(0.0f, std::floor(minY)));
+        t.maxX = int(std::min(float(width - 1), std::ceil(maxX)));
+        t.maxY = int(std::min(float(height - 1), std::ceil(maxY)));
+        if (t.minX > t.maxX || t.minY > t.maxY)
+            return;
+        t.diagonals = diagonals;
+        triangles.push_back(t);
+    }
+
+    void setupLine(std::vector<Line> &lines, glm::vec4 c0, glm::vec4 c1)
+    {
+        float d0 = c0.z + c0.w, d1 = c1.z + c1.w;
+        if (d0 < 0.0f && d1 < 0.0f)
+            return;
+        if (d0 < 0.0f)
+            c0 += d0 / (d0 - d1) * (c1 - c0);
+        else if (d1 < 0.0f)
+            c1 += d1 / (d1 - d0) * (c0 - c1);
+        Vertex p = toWindow(c0, glm::vec3(0.0f)), q = toWindow(c1, glm::vec3(0.0f));
+        lines.push_back({p.x, p.y, p.z, q.x, q.y, q.z});
+    }
+
+    void bin(std::vector<std::vector<uint32_t>> &bins, int minX, int minY, int maxX, int maxY, uint32_t id)
+    {
+        for (int ty = minY / TILE; ty <= maxY / TILE; ++ty)
+            for (int tx = minX / TILE; tx <= maxX / TILE; ++tx)
+                bins[ty * tilesX + tx].push_back(id);
+    }
+
+    void binLines(std::vector<std::vector<uint32_t>> &bins, const std::vector<Line> &lines)
+    {
+        for (uint32_t i = 0; i < lines.size(); ++i)
+        {
+            const Line &l = lines[i];
+            int minX = int(std::max(0.0f, std::floor(std::min(l.x0, l.x1))));
+            int minY = int(std::max(0.0f, std::floor(std::min(l.y0, l.y1))));
+            int maxX = int(std::min(float(width - 1), std::ceil(std::max(l.x0, l.x1))));
+            int maxY = int(std::min(float(height - 1), std::ceil(std::max(l.y0, l.y1))));
+            if (minX <= maxX && minY <= maxY)
+                bin(bins, minX, minY, maxX, maxY, i);
+        }
+    }
+
+    // Calls shade(x, y, e) for every pixel of the tile the triangle covers,
+    // where e holds the three edge functions at the pixel centre
+    template <typename Shade>
+    static void rasterize(const Triangle &t, int x0, int y0, int x1, int y1, Shade shade)
+    {
+        x0 = std::max(x0, t.minX);
+        y0 = std::max(y0, t.minY);
+        x1 = std::min(x1, t.maxX + 1);
+        y1 = std::min(y1, t.maxY + 1);
+#ifdef SOFT_RASTER_SSE2
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 steps = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        __m128 a[3], tl[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            a[k] = _mm_set1_ps(t.a[k]);
+            tl[k] = _mm_castsi128_ps(_mm_set1_epi32(t.topLeft[k] ? -1 : 0));
+        }
+        for (int y = y0; y < y1; ++y)
+        {
+            float yc = y + 0.5f;
+            __m128 row[3];
+            for (int k = 0; k < 3; ++k)
+                row[k] = _mm_set1_ps(t.b[k] * yc + t.c[k]);
+            for (int x = x0; x < x1; x += 4)
+            {
+                __m128 xs = _mm_add_ps(_mm_set1_ps(float(x)), steps);
+                __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                __m128 e[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    e[k] = _mm_add_ps(_mm_mul_ps(a[k], xs), row[k]);
+                    __m128 in = _mm_or_ps(_mm_cmpgt_ps(e[k], zero), _mm_and_ps(_mm_cmpeq_ps(e[k], zero), tl[k]));
+                    inside = _mm_and_ps(inside, in);
+                }
+                int mask = _mm_movemask_ps(inside);
+                if (x1 - x < 4)
+                    mask &= (1 << (x1 - x)) - 1;
+                if (!mask)
+                    continue;
+                alignas(16) float e0[4], e1[4], e2[4];
+                _mm_store_ps(e0, e[0]);
+                _mm_store_ps(e1, e[1]);
+                _mm_store_ps(e2, e[2]);
+                for (int i = 0; i < 4; ++i)
+                    if (mask & (1 << i))
+                        shade(x + i, y, glm::vec3(e0[i], e1[i], e2[i]));
+            }
+        }
+#else
+        for (int y = y0; y < y1; ++y)
+            for (int x = x0; x < x1; ++x)
+            {
+                glm::vec3 e;
+                bool inside = true;
+                for (int k = 0; k < 3; ++k)
+                {
+                    e[k] = t.a[k] * (x + 0.5f) + t.b[k] * (y + 0.5f) + t.c[k];
+                    inside = inside && (e[k] > 0.0f || (e[k] == 0.0f && t.topLeft[k]));
+                }
+                if (inside)
+                    shade(x, y, e);
+            }
+#endif
+    }
+
+    // One pixel per step along the major axis, at the centres inside
+    // [start, end), as GL's diamond-exit rule gives for 1-pixel lines
+    template <typename Shade>
+    static void rasterize(const Line &l, int x0, int y0, int x1, int y1, Shade shade)
+    {
+        float dx = l.x1 - l.x0, dy = l.y1 - l.y0;
+        bool xMajor = std::fabs(dx) >= std::fabs(dy);
+        float from = xMajor ? l.x0 : l.y0, to = xMajor ? l.x1 : l.y1;
+        float major = xMajor ? dx : dy;
+        if (major == 0.0f)
+            return;
+        int first = int(std::ceil(std::min(from, to) - 0.5f));
+        int last = int(std::ceil(std::max(from, to) - 0.5f)) - 1;
+        first = std::max(first, xMajor ? x0 : y0);
+        last = std::min(last, (xMajor ? x1 : y1) - 1);
+        for (int i = first; i <= last; ++i)
+        {
+            float t = (i + 0.5f - from) / major;
+            float minor = xMajor ? l.y0 + t * dy : l.x0 + t * dx;
+            int m = int(std::ceil(minor)) - 1; // A line between two pixels takes the lower one
+            int x = xMajor ? i : m, y = xMajor ? m : i;
+            if (x < x0 || x >= x1 || y < y0 || y >= y1)
+                continue;
+            shade(x, y, l.z0 + t * (l.z1 - l.z0));
+        }
+    }
+
+    // Window depth as the depth buffer stores it, so near-ties (the net
+    // lying on a grid plane, say) compare as they do on the GPU
+    static uint32_t depthValue(float z)
+    {
+        return uint32_t(glm::clamp(z, 0.0f, 1.0f) * 16777215.0f + 0.5f);
+    }
+
+    // GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA into an RGBA8 target, which
+    // rounds after every blend
+    static void blend(glm::vec4 &dst, const glm::vec4 &src)
+    {
+        glm::vec4 mixed(glm::vec3(src) * src.a + glm::vec3(dst) * (1.0f - src.a),
+                        src.a * src.a + dst.a * (1.0f - src.a));
+        dst = glm::floor(glm::clamp(mixed, 0.0f, 1.0f) * 255.0f + 0.5f) / 255.0f;
+    }
+
+    void renderTile(const SoftScene &scene, int tx, int ty, Image &image)
+    {
+        static thread_local std::vector<TileBuffers> scratch(1);
+        TileBuffers &tb = scratch[0];
+        int x0 = tx * TILE, y0 = ty * TILE;
+        int x1 = std::min(x0 + TILE, width), y1 = std::min(y0 + TILE, height);
+        size_t tile = size_t(ty) * tilesX + tx;
+        auto at = [&](int x, int y)
+        {
+            return (y - y0) * TILE + (x - x0);
+        };
+
+        for (int i = 0; i < TILE * TILE; ++i)
+        {
+            tb.color[i] = glm::vec4(0.05f, 0.05f, 0.1f, 1.0f);
+            tb.depth[i] = 16777215u;
+        }
+
+        // Lines that test and write depth, like the grid and edge passes
+        auto drawLines = [&](const std::vector<Line> &lines, const std::vector<uint32_t> &ids, const glm::vec4 &color)
+        {
+            auto shade = [&](int x, int y, float z)
+            {
+                int p = at(x, y);
+                uint32_t depth = depthValue(z);
+                if (depth < tb.depth[p])
+                {
+                    tb.depth[p] = depth;
+                    blend(tb.color[p], color);
+                }
+            };
+            for (uint32_t id : ids)
+                rasterize(lines[id], x0, y0, x1, y1, shade);
+        };
+
+        // 1. Grid
+        if (scene.proceduralGrid)
+            drawProceduralGrid(scene, tb, x0, y0, x1, y1);
+        else
+            drawLines(gridLines, gridBins[tile], glm::vec4(0.5f, 0.5f, 0.5f, 0.2f));
+
+        const glm::vec4 faceColor(0.8f, 0.8f, 0.8f, 0.3f);
+        if (scene.wireframe)
+        {
+            // 2. Faces and their outlines in one pass, depth tested but not written
+            for (uint32_t id : faceBins[tile])
+            {
+                const Triangle &t = triangles[id];
+                glm::vec3 diagonal((t.diagonals >> 0) & 1, (t.diagonals >> 1) & 1, (t.diagonals >> 2) & 1);
+                auto shade = [&](int x, int y, const glm::vec3 &e)
+                {
+                    int p = at(x, y);
+                    float z = t.zdx * (x + 0.5f) + t.zdy * (y + 0.5f) + t.zc;
+                    if (depthValue(z) >= tb.depth[p])
+                        return;
+                    glm::vec3 bary = barycentric(t, e);
+                    glm::vec3 fw = glm::abs(barycentric(t, e + glm::vec3(t.a[0], t.a[1], t.a[2])) - bary) +
+                                   glm::abs(barycentric(t, e + glm::vec3(t.b[0], t.b[1], t.b[2])) - bary);
+                    glm::vec3 d = (bary + diagonal) / fw;
+                    float edge = 1.0f - glm::clamp(std::min(d.x, std::min(d.y, d.z)) - 0.5f, 0.0f, 1.0f);
+                    blend(tb.color[p], glm::mix(faceColor, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), edge));
+                };
+                rasterize(t, x0, y0, x1, y1, shade);
+            }
+        }
+        else if (scene.orderIndependent)
+        {
+            // 2. Edges first
+            drawLines(edges, edgeBins[tile], glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+            // 3. Weighted blended faces, pushed back by the GL polygon offset (1, 1)
+            for (int i = 0; i < TILE * TILE; ++i)
+            {
+                tb.accum[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+                tb.weight[i] = 0.0f;
+            }
+            bool any = false;
+            for (uint32_t id : faceBins[tile])
+            {
+                const Triangle &t = triangles[id];
+                float offset = std::max(std::fabs(t.zdx), std::fabs(t.zdy)) + 1.0f / 16777215.0f;
+                auto shade = [&](int x, int y, const glm::vec3 &)
+                {
+                    int p = at(x, y);
+                    float z = t.zdx * (x + 0.5f) + t.zdy * (y + 0.5f) + t.zc;
+                    if (depthValue(z + offset) >= tb.depth[p])
+                        return;
+                    float ndc = 2.0f * z - 1.0f;
+                    float distance = scene.projection[3][2] / (ndc + scene.projection[2][2]);
+                    float w = faceColor.a * glm::clamp(10.0f / (1e-5f + std::pow(distance / 5.0f, 2.0f) +
+                                                                std::pow(distance / 200.0f, 6.0f)),
+                                                       1e-2f, 3e3f);
+                    tb.accum[p] += glm::vec4(glm::vec3(faceColor) * faceColor.a * w, 0.0f);
+                    tb.accum[p].a *= 1.0f - faceColor.a;
+                    tb.weight[p] += faceColor.a * w;
+                    any = true;
+                };
+                rasterize(t, x0, y0, x1, y1, shade);
+            }
+            if (any)
+                for (int y = y0; y < y1; ++y)
+                    for (int x = x0; x < x1; ++x)
+                    {
+                        int p = at(x, y);
+                        float revealage = tb.accum[p].a;
+                        if (revealage >= 1.0f)
+                            continue;
+                        glm::vec3 color = glm::vec3(tb.accum[p]) / std::max(tb.weight[p], 1e-5f);
+                        blend(tb.color[p], glm::vec4(color, 1.0f - revealage));
+                    }
+        }
+        else
+        {
+            // 2. Faces, depth tested but not written
+            for (uint32_t id : faceBins[tile])
+            {
+                const Triangle &t = triangles[id];
+                auto shade = [&](int x, int y, const glm::vec3 &)
+                {
+                    int p = at(x, y);
+                    float z = t.zdx * (x + 0.5f) + t.zdy * (y + 0.5f) + t.zc;
+                    if (depthValue(z) < tb.depth[p])
+                        blend(tb.color[p], faceColor);
+                };
+                rasterize(t, x0, y0, x1, y1, shade);
+            }
+
+            // 3. Edges
+            drawLines(edges, edgeBins[tile], glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        }
+
+        // Window rows run bottom-up; the image is top row first
+        for (int y = y0; y < y1; ++y)
+        {
+            uint8_t *out = &image.pixels[(size_t(height - 1 - y) * width + x0) * 3];
+            for (int x = x0; x < x1; ++x, out += 3)
+            {
+                const glm::vec4 &c = tb.color[at(x, y)];
+                for (int k = 0; k < 3; ++k)
+                    out[k] = uint8_t(glm::clamp(c[k], 0.0f, 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    // Perspective-correct barycentrics from the edge functions at a point
+    static glm::vec3 barycentric(const Triangle &t, const glm::vec3 &e)
+    {
+        glm::vec3 q = e * glm::vec3(t.v[0].invW, t.v[1].invW, t.v[2].invW);
+        return (q.x * t.v[0].bary + q.y * t.v[1].bary + q.z * t.v[2].bary) / (q.x + q.y + q.z);
+    }
+
+    // The procedural grid shader, per pixel: each view ray meets the three
+    // axis planes, and screen-space derivatives come from the neighbouring
+    // pixels' rays as the GPU's fwidth does
+    void drawProceduralGrid(const SoftScene &scene, TileBuffers &tb, int x0, int y0, int x1, int y1)
+    {
+        glm::mat4 viewProjection = scene.projection * scene.view;
+        glm::mat4 inverse = glm::inverse(viewProjection);
+        auto unproject = [&](float nx, float ny, float nz)
+        {
+            glm::vec4 v = inverse * glm::vec4(nx, ny, nz, 1.0f);
+            return glm::vec3(v) / v.w;
+        };
+        // Near and far points are affine in window position
+        glm::vec3 near0 = unproject(-1.0f, -1.0f, -1.0f), far0 = unproject(-1.0f, -1.0f, 1.0f);
+        glm::vec3 nearX = (unproject(1.0f, -1.0f, -1.0f) - near0) / float(width);
+        glm::vec3 nearY = (unproject(-1.0f, 1.0f, -1.0f) - near0) / float(height);
+        glm::vec3 farX = (unproject(1.0f, -1.0f, 1.0f) - far0) / float(width);
+        glm::vec3 farY = (unproject(-1.0f, 1.0f, 1.0f) - far0) / float(height);
+
+        for (int plane = 0; plane < 3; ++plane)
+        {
+            // A ray meets the plane when its near and far points lie on
+            // opposite sides. Both are affine over the tile, so if neither
+            // changes sign between the corners and they agree, no ray does.
+            float nearMin = 1e30f, nearMax = -1e30f, farMin = 1e30f, farMax = -1e30f;
+            for (int corner = 0; corner < 4; ++corner)
+            {
+                float x = float(corner & 1 ? x1 : x0), y = float(corner & 2 ? y1 : y0);
+                float n = (near0 + x * nearX + y * nearY)[plane], f = (far0 + x * farX + y * farY)[plane];
+                nearMin = std::min(nearMin, n);
+                nearMax = std::max(nearMax, n);
+                farMin = std::min(farMin, f);
+                farMax = std::max(farMax, f);
+            }
+            if ((nearMin > 0.0f && farMin > 0.0f) || (nearMax < 0.0f && farMax < 0.0f))
+                continue;
+
+            int u = plane == 0 ? 1 : 0, v = plane == 2 ? 1 : 2;
+            auto gridUV = [&](float x, float y, glm::vec3 &nearPoint, glm::vec3 &hit, float &t)
+            {
+                nearPoint = near0 + x * nearX + y * nearY;
+                glm::vec3 ray = far0 + x * farX + y * farY - nearPoint;
+                t = -nearPoint[plane] / ray[plane];
+                hit = nearPoint + t * ray;
+                return glm::vec2(hit[u], hit[v]);
+            };
+            for (int y = y0; y < y1; ++y)
+                for (int x = x0; x < x1; ++x)
+                {
+                    glm::vec3 nearPoint, hit, unused;
+                    float t, tn;
+                    glm::vec2 uv = gridUV(x + 0.5f, y + 0.5f, nearPoint, hit, t);
+                    if (!(t > 0.0f && t < 1.0f))
+                        continue;
+                    glm::vec2 fw = glm::abs(gridUV(x + 1.5f, y + 0.5f, unused, unused, tn) - uv) +
+                                   glm::abs(gridUV(x + 0.5f, y + 1.5f, unused, unused, tn) - uv);
+                    glm::vec2 d = glm::abs(glm::fract(uv - 0.5f) - 0.5f) / fw;
+                    float line = 1.0f - std::min(std::min(d.x, d.y), 1.0f);
+                    float fade = 1.0f - glm::smoothstep(20.0f, 60.0f, glm::length(hit - nearPoint));
+                    float alpha = 0.2f * line * fade;
+                    if (alpha <= 0.0f)
+                        continue;
+                    glm::vec4 clipHit = viewProjection * glm::vec4(hit, 1.0f);
+                    float z = 0.5f * clipHit.z / clipHit.w + 0.5f;
+                    int p = (y - y0) * TILE + (x - x0);
+                    uint32_t depth = depthValue(z);
+                    if (depth >= tb.depth[p])
+                        continue;
+                    tb.depth[p] = depth;
+                    blend(tb.color[p], glm::vec4(0.5f, 0.5f, 0.5f, alpha));
+                }
+        }
+    }
+};
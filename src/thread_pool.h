@@ -0,0 +1,124 @@
+// thread_pool.h - Fixed set of worker threads for data-parallel loops
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Workers sleep between jobs and take indices from a shared counter, so
+// uneven items (busy and empty tiles, say) balance themselves. The calling
+// thread works through the same counter instead of waiting idle.
+struct ThreadPool
+{
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, finished;
+    const std::function<void(size_t)> *body = nullptr;
+    size_t jobSize = 0;
+    std::atomic<size_t> next{0};
+    size_t busy = 0;         // Workers still inside the current job
+    uint64_t generation = 0; // Bumped per job, so a worker runs each job once
+    bool stopping = false;
+    bool started = false; // Set even when start() asked for no workers
+
+    // Starts count workers besides the caller: 0 leaves the caller working
+    // alone, -1 fills the remaining hardware threads. Later calls do nothing
+    // until stop().
+    void start(int count = -1)
+    {
+        if (started)
+            return;
+        started = true;
+        if (count < 0)
+            count = int(std::max(1u, std::thread::hardware_concurrency())) - 1;
+        for (int i = 0; i < count; ++i)
+            workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+
+    size_t threadCount() const
+    {
+        return workers.size() + 1;
+    }
+
+    // Runs body(0) .. body(count - 1) across every thread and returns once all are done
+    void parallelFor(size_t count, const std::function<void(size_t)> &job)
+    {
+        if (workers.empty() || count <= 1)
+        {
+            for (size_t i = 0; i < count; ++i)
+                job(i);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            body = &job;
+            jobSize = count;
+            next = 0;
+            busy = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+        drain(job, count);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]
+                      {
+                          return busy == 0;
+                      });
+        body = nullptr;
+    }
+
+    void drain(const std::function<void(size_t)> &job, size_t count)
+    {
+        for (size_t i = next++; i < count; i = next++)
+            job(i);
+    }
+
+    void workerLoop()
+    {
+        uint64_t seen = 0;
+        for (;;)
+        {
+            const std::function<void(size_t)> *job;
+            size_t count;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]
+                          {
+                              return stopping || generation != seen;
+                          });
+                if (stopping)
+                    return;
+                seen = generation;
+                job = body;
+                count = jobSize;
+            }
+            drain(*job, count);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--busy == 0)
+                    finished.notify_one();
+            }
+        }
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+        workers.clear();
+        stopping = false;
+        started = false;
+    }
+};